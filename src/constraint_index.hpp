@@ -0,0 +1,137 @@
+#ifndef CONSTRAINT_INDEX_H
+#define CONSTRAINT_INDEX_H
+
+#include "constants.hpp"
+#include "prune_kernel.hpp"
+
+#include <string>
+#include <vector>
+
+// Letter counts are encoded in 2 bits, so count thresholds run 1..3
+const size_t MAX_LETTER_COUNT = 3;
+
+/**
+ * Inverted index over a wordlist, with one bitset of words per
+ * (position, letter) and per (letter, count >= t).
+ *
+ * Every constraint of a PruneMask is then a single AND/ANDNOT over whole
+ * bitsets, so evaluating a guess against the full dictionary streams through
+ * a handful of bitsets instead of checking each word.
+ */
+class ConstraintIndex {
+ public:
+  ConstraintIndex(const std::vector<std::string>& wordlist)
+    : size_(wordlist.size()), blocks_((wordlist.size() + 63) / 64) {
+    index(wordlist);
+  }
+
+  ConstraintIndex(const ConstraintIndex&) = delete;
+
+  /**
+   * Set bit i of pruned for every word i that fails the constraints of m.
+   * Same contract as prune_words over the whole wordlist.
+   */
+  void prune(const PruneMask& m, uint64_t* pruned) const;
+
+ private:
+  void index(const std::vector<std::string>& wordlist);
+
+  uint64_t* placed(size_t pos, size_t letter) {
+    return &bits_[(pos * 26 + letter) * blocks_];
+  }
+
+  const uint64_t* placed(size_t pos, size_t letter) const {
+    return &bits_[(pos * 26 + letter) * blocks_];
+  }
+
+  // Words with at least ct (1..MAX_LETTER_COUNT) of letter
+  uint64_t* at_least(size_t letter, size_t ct) {
+    return &bits_[(NUM_LETTERS * 26 + letter * MAX_LETTER_COUNT + ct - 1)
+                  * blocks_];
+  }
+
+  const uint64_t* at_least(size_t letter, size_t ct) const {
+    return &bits_[(NUM_LETTERS * 26 + letter * MAX_LETTER_COUNT + ct - 1)
+                  * blocks_];
+  }
+
+  const size_t size_;
+  const size_t blocks_;
+
+  /**
+   * All bitsets back to back, blocks_ words each: NUM_LETTERS * 26
+   * (position, letter) sets followed by 26 * MAX_LETTER_COUNT
+   * (letter, count) sets.
+   */
+  std::vector<uint64_t> bits_;
+};
+
+void ConstraintIndex::prune(const PruneMask& m, uint64_t* pruned) const {
+  // Prune words missing a correct placement
+  for (size_t pos = 0; pos < NUM_LETTERS; ++pos) {
+    if ((m.c_mask >> BITS_PER_LETTER * pos) & 0b11111) {
+      const uint64_t* words = placed(pos, (m.c_check >> BITS_PER_LETTER * pos) & 0b11111);
+      for (size_t b = 0; b < blocks_; ++b) {
+        pruned[b] |= ~words[b];
+      }
+    }
+  }
+
+  // Prune words with a wrong placement (cleared blocks of w_mask)
+  for (size_t pos = 0; pos < NUM_LETTERS; ++pos) {
+    if (!((m.w_mask >> BITS_PER_LETTER * pos) & 0b11111)) {
+      const uint64_t* words = placed(pos, (m.w_check >> BITS_PER_LETTER * pos) & 0b11111);
+      for (size_t b = 0; b < blocks_; ++b) {
+        pruned[b] |= words[b];
+      }
+    }
+  }
+
+  for (size_t l = 0; l < 26; ++l) {
+    // Prune words under the minimum count
+    size_t min_ct = (m.min_cts >> BITS_PER_COUNT * l) & 0b11;
+    if (min_ct) {
+      const uint64_t* words = at_least(l, min_ct);
+      for (size_t b = 0; b < blocks_; ++b) {
+        pruned[b] |= ~words[b];
+      }
+    }
+
+    // Prune words over the maximum count
+    size_t max_ct = (m.max_cts >> BITS_PER_COUNT * l) & 0b11;
+    if (((m.max_mask >> BITS_PER_COUNT * l) & 0b11) && max_ct < MAX_LETTER_COUNT) {
+      const uint64_t* words = at_least(l, max_ct + 1);
+      for (size_t b = 0; b < blocks_; ++b) {
+        pruned[b] |= words[b];
+      }
+    }
+  }
+
+  // The complemented sets above also set the padding past the last word
+  if (size_ % 64) {
+    pruned[blocks_ - 1] &= ((uint64_t) 1 << (size_ % 64)) - 1;
+  }
+}
+
+void ConstraintIndex::index(const std::vector<std::string>& wordlist) {
+  bits_.resize((NUM_LETTERS * 26 + 26 * MAX_LETTER_COUNT) * blocks_, 0);
+
+  for (size_t i = 0; i < size_; ++i) {
+    const uint64_t bit = (uint64_t) 1 << (i % 64);
+
+    uint8_t counts[26] = {0};
+    for (size_t pos = 0; pos < NUM_LETTERS; ++pos) {
+      uint8_t l = (uint8_t) (wordlist[i][pos] - 'a');
+      placed(pos, l)[i / 64] |= bit;
+      ++counts[l];
+    }
+
+    for (size_t l = 0; l < 26; ++l) {
+      for (size_t ct = 1; ct <= counts[l] && ct <= MAX_LETTER_COUNT; ++ct) {
+        at_least(l, ct)[i / 64] |= bit;
+      }
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,286 @@
+#ifndef DECISION_TREE_H
+#define DECISION_TREE_H
+
+#include "constants.hpp"
+#include "guess_pair.hpp"
+#include "mapped_file.hpp"
+#include "wordle_solver.hpp"
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * .dtree layout, all fields little endian:
+ *
+ *   [0, 64)   DtreeHeader
+ *   [64, ...) n_nodes DtreeNode, the root first
+ *   then      n_edges DtreeEdge
+ *
+ * Each node's edges are contiguous and sorted by code, one per pattern the
+ * answers left at the node can give back other than ALL_GREEN.
+ */
+const char DTREE_MAGIC[8] = {'W', 'B', 'D', 'T', 'R', 'E', 'E', '\0'};
+const uint32_t DTREE_VERSION = 1;
+
+struct DtreeHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t n_guesses;
+  uint64_t n_answers;
+  // wordlist_fingerprint of the lists the tree was built from
+  uint64_t fingerprint;
+  uint64_t n_nodes;
+  uint64_t n_edges;
+  uint64_t padding;
+};
+
+static_assert(sizeof(DtreeHeader) == 64, "header fills one cache line");
+
+struct DtreeNode {
+  uint32_t guess;
+  // Guesses left in the worst case, this one included
+  uint32_t value;
+  uint32_t first_edge;
+  uint32_t n_edges;
+};
+
+struct DtreeEdge {
+  uint32_t code;
+  uint32_t child;
+};
+
+/**
+ * Optimal play as a tree of guesses, to look up the next guess for a game
+ * in progress without searching.
+ *
+ * Built from a WordleSolver and written out once, then mapped read-only: a
+ * lookup walks one node per guess played.
+ */
+class DecisionTree {
+ public:
+  static constexpr size_t NO_GUESS = SIZE_MAX;
+
+  /**
+   * Write optimal play for solver's unpruned answers to os. Every state plays
+   * a guess finishing within its exact value, found by iterative deepening
+   * over solver.solvable(), so the memo from an earlier solve() is reused.
+   *
+   * Returns false, writing nothing, if some state has no such guess: an answer
+   * that isn't a guess, or lists that can't be solved at all.
+   */
+  static bool build(WordleSolver& solver, std::ostream& os, uint64_t fingerprint);
+
+  /**
+   * Map a tree written by build(), returning false if it can't be read, is
+   * malformed or was built from other word lists.
+   */
+  bool open(const std::string& filename, uint64_t fingerprint);
+
+  /**
+   * The guess to play after the given (guess, pattern code) history, and
+   * the guesses left in the worst case, or NO_GUESS if the history leaves
+   * the tree or already found the answer.
+   */
+  std::pair<size_t, int> next_guess(const std::vector<std::pair<size_t, uint8_t>>& history) const;
+
+  size_t size() const {
+    return n_nodes_;
+  }
+
+ private:
+  /**
+   * Append the subtree for pruned, which can be solved within budget
+   * guesses, returning the index of its root, or NO_GUESS if it can't be.
+   */
+  static size_t add_node(WordleSolver& solver, const boost::dynamic_bitset<>& pruned, int budget,
+                         std::vector<DtreeNode>& nodes, std::vector<DtreeEdge>& edges);
+
+  MappedFile file_;
+  const DtreeNode* nodes_ = nullptr;
+  const DtreeEdge* edges_ = nullptr;
+  size_t n_nodes_ = 0;
+};
+
+bool DecisionTree::build(WordleSolver& solver, std::ostream& os, uint64_t fingerprint) {
+  const PruneIndex& pindex = solver.pindex();
+
+  // No play finds an answer that isn't a guess
+  for (size_t s_idx = 0; s_idx < pindex.size(); ++s_idx) {
+    if (pindex.guess_of(s_idx) == PruneIndex::NO_GUESS) {
+      return false;
+    }
+  }
+
+  std::vector<DtreeNode> nodes;
+  std::vector<DtreeEdge> edges;
+  if (add_node(solver, boost::dynamic_bitset<>(pindex.size()), UNBOUNDED,
+               nodes, edges) == NO_GUESS) {
+    return false;
+  }
+
+  DtreeHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, DTREE_MAGIC, sizeof(DTREE_MAGIC));
+  header.version = DTREE_VERSION;
+  header.n_guesses = pindex.guesses();
+  header.n_answers = pindex.size();
+  header.fingerprint = fingerprint;
+  header.n_nodes = nodes.size();
+  header.n_edges = edges.size();
+
+  os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  os.write(reinterpret_cast<const char*>(nodes.data()),
+           (long) (nodes.size() * sizeof(DtreeNode)));
+  os.write(reinterpret_cast<const char*>(edges.data()),
+           (long) (edges.size() * sizeof(DtreeEdge)));
+  os.flush();
+  return true;
+}
+
+size_t DecisionTree::add_node(WordleSolver& solver, const boost::dynamic_bitset<>& pruned,
+                              int budget,
+                              std::vector<DtreeNode>& nodes,
+                              std::vector<DtreeEdge>& edges) {
+  const PruneIndex& pindex = solver.pindex();
+  const size_t survivors = pruned.size() - pruned.count();
+  assert(survivors > 0);
+
+  size_t guess = NO_GUESS;
+  int value = 1;
+  if (survivors == 1) {
+    guess = pindex.guess_of(first_survivor(pruned));
+  } else {
+    // The parent's guess already showed this state takes at most budget, and
+    // guessing each answer in turn takes at most survivors
+    const int most = std::min(budget, (int) survivors);
+    for (value = min_guesses(survivors); value <= most; ++value) {
+      std::pair<size_t, bool> start = solver.solvable(pruned, value);
+      if (start.second) {
+        guess = start.first;
+        break;
+      }
+    }
+  }
+  if (guess == NO_GUESS) {
+    return NO_GUESS;
+  }
+
+  const size_t index = nodes.size();
+  nodes.push_back({(uint32_t) guess, (uint32_t) value, (uint32_t) edges.size(), 0});
+
+  // An answer giving back each pattern, to reach the child from
+  size_t reply[NUM_PATTERNS];
+  std::fill(reply, reply + NUM_PATTERNS, NO_GUESS);
+  for (size_t s_idx = 0; s_idx < pindex.size(); ++s_idx) {
+    const uint8_t code = pindex.code(guess, s_idx);
+    if (!pruned[s_idx] && code != ALL_GREEN && reply[code] == NO_GUESS) {
+      reply[code] = s_idx;
+    }
+  }
+
+  // Edges first, so this node's stay contiguous as the children add theirs
+  const size_t first = edges.size();
+  for (size_t code = 0; code < NUM_PATTERNS; ++code) {
+    if (reply[code] != NO_GUESS) {
+      edges.push_back({(uint32_t) code, 0});
+    }
+  }
+  nodes[index].n_edges = (uint32_t) (edges.size() - first);
+
+  boost::dynamic_bitset<> next;
+  for (size_t e = first; e < first + nodes[index].n_edges; ++e) {
+    pindex.apply(guess, reply[edges[e].code], pruned, next);
+    const size_t child = add_node(solver, next, value - 1, nodes, edges);
+    if (child == NO_GUESS) {
+      return NO_GUESS;
+    }
+    edges[e].child = (uint32_t) child;
+  }
+
+  return index;
+}
+
+bool DecisionTree::open(const std::string& filename, uint64_t fingerprint) {
+  nodes_ = nullptr;
+  edges_ = nullptr;
+  n_nodes_ = 0;
+
+  if (!file_.open(filename) || file_.size() < sizeof(DtreeHeader)) {
+    return false;
+  }
+
+  const DtreeHeader& header = *reinterpret_cast<const DtreeHeader*>(file_.data());
+  if (memcmp(header.magic, DTREE_MAGIC, sizeof(DTREE_MAGIC)) != 0 ||
+      header.version != DTREE_VERSION ||
+      header.fingerprint != fingerprint ||
+      header.n_nodes == 0 ||
+      header.n_nodes > file_.size() / sizeof(DtreeNode) ||
+      header.n_edges > file_.size() / sizeof(DtreeEdge) ||
+      file_.size() != sizeof(DtreeHeader) + header.n_nodes * sizeof(DtreeNode) +
+                      header.n_edges * sizeof(DtreeEdge)) {
+    return false;
+  }
+
+  const DtreeNode* nodes = reinterpret_cast<const DtreeNode*>(
+      file_.data() + sizeof(DtreeHeader));
+  const DtreeEdge* edges = reinterpret_cast<const DtreeEdge*>(nodes + header.n_nodes);
+
+  // Checked once here, so lookups can trust every index
+  for (size_t i = 0; i < header.n_nodes; ++i) {
+    const DtreeNode& node = nodes[i];
+    if (node.guess >= header.n_guesses ||
+        (uint64_t) node.first_edge + node.n_edges > header.n_edges) {
+      return false;
+    }
+    for (size_t e = node.first_edge; e < node.first_edge + node.n_edges; ++e) {
+      if (edges[e].code >= ALL_GREEN || edges[e].child >= header.n_nodes ||
+          (e > node.first_edge && edges[e].code <= edges[e - 1].code)) {
+        return false;
+      }
+    }
+  }
+
+  nodes_ = nodes;
+  edges_ = edges;
+  n_nodes_ = header.n_nodes;
+  return true;
+}
+
+std::pair<size_t, int> DecisionTree::next_guess(
+    const std::vector<std::pair<size_t, uint8_t>>& history) const {
+  const std::pair<size_t, int> none(NO_GUESS, 0);
+  if (!nodes_) {
+    return none;
+  }
+
+  const DtreeNode* node = nodes_;
+  for (const std::pair<size_t, uint8_t>& turn : history) {
+    if (turn.first != node->guess) {
+      return none;
+    }
+
+    const DtreeEdge* begin = edges_ + node->first_edge;
+    const DtreeEdge* end = begin + node->n_edges;
+    const DtreeEdge* it = std::lower_bound(begin, end, turn.second,
+        [](const DtreeEdge& e, uint8_t code) {
+          return e.code < code;
+        });
+    if (it == end || it->code != turn.second) {
+      // Solved, or a pattern none of the answers give
+      return none;
+    }
+    node = nodes_ + it->child;
+  }
+
+  return std::pair<size_t, int>(node->guess, (int) node->value);
+}
+
+#endif
@@ -2,84 +2,163 @@
 #define DICTIONARY_H
 
 #include "constants.hpp"
+#include "constraint_index.hpp"
 #include "guess.hpp"
+#include "prune_kernel.hpp"
 
 #include <assert.h>
 
+#include <algorithm>
 #include <bitset>
 #include <iostream>
 #include <map>
-#include <stack>
 #include <vector>
 
-const size_t BITS_PER_LETTER = 5;
-const size_t BITS_PER_COUNT = 2;
-const uint64_t LSB_MASK = 0x5555555555555555;
-const uint64_t MSB_MASK = 0xAAAAAAAAAAAAAAAA;
+// Search depth the prune arena is sized for up front. Solves rarely go past
+// 6 guesses, so this only grows on pathological inputs.
+const size_t DEFAULT_MAX_DEPTH = 16;
+
+/**
+ * How a prune finds the words to check.
+ *
+ * PRUNE_SCAN:    run the kernel over the whole dictionary every time.
+ * PRUNE_COMPACT: each prune also writes the survivors' encoded words into the
+ *                next arena slot, so the next prune only scans those.
+ * PRUNE_INDEX:   evaluate the guess with bitset ops over a ConstraintIndex of
+ *                the whole dictionary.
+ */
+enum PruneMode {
+  PRUNE_SCAN,
+  PRUNE_COMPACT,
+  PRUNE_INDEX,
+};
 
 class Dictionary {
  public:
-  Dictionary(const std::vector<std::string>& wordlist)
-    : reference_words(wordlist){
+  Dictionary(const std::vector<std::string>& wordlist,
+             PruneMode mode = PRUNE_COMPACT,
+             size_t max_depth = DEFAULT_MAX_DEPTH)
+    : reference_words(wordlist),
+      mode_(mode),
+      index_(wordlist),
+      blocks_((wordlist.size() + 63) / 64),
+      arena_((max_depth + 1) * blocks_, 0),
+      live_(max_depth + 1, wordlist.size()),
+      live_idx_((max_depth + 1) * wordlist.size()),
+      prune_bits_(blocks_) {
     encode_wordlist();
   }
 
-  ~Dictionary() {
-    while (pruned_stack_.size()) {
-      delete pruned_stack_.top();
-      pruned_stack_.pop();
-    }
-  }
+  Dictionary(const Dictionary&) = delete;
 
   /**
    * Prune dictionary using the inferences made in guess.
    *
-   * Adds a pruned vector to pruned_stack_.
-   * Returns a pointer to this.pruned_ after pruning the given guess.
+   * Writes the new pruned bitset to the next arena slot, along with the list
+   * of surviving indices (and in PRUNE_COMPACT mode, their encoded words).
+   * Returns a pointer to the blocks of the new pruned bitset, valid until the
+   * next prune.
    */
-  std::vector<bool>* prune(const Guess& guess);
+  const uint64_t* prune(const Guess& guess);
+
+  /**
+   * Prune dictionary using an already compiled mask, e.g. one precomputed by
+   * FeedbackTable.
+   */
+  const uint64_t* prune(const PruneMask& m);
 
   void pop();
 
+  /**
+   * Words consistent with guess over the whole dictionary, regardless of the
+   * current prunes. Answered from the ConstraintIndex without touching the
+   * prune arena, so it works for any constraint set (e.g. from Guess::set).
+   */
+  boost::dynamic_bitset<> matching(const Guess& guess) const;
+
   size_t size() const;
 
   size_t count() const;
 
+  /**
+   * Index into reference_words of the k-th unpruned word, for k < count().
+   * Lets callers walk only the survivors instead of testing every word.
+   */
+  size_t live(size_t k) const {
+    return live_idx_[depth_ * size() + k];
+  }
+
   const std::vector<std::string> reference_words;
 
   bool is_pruned(size_t i) const {
-    return pruned_->at(i);
+    return (pruned()[i / 64] >> (i % 64)) & 1;
   }
 
-  // TODO
-  const std::vector<bool>& key() const {
-    return *pruned_;
+  /**
+   * The current pruned bitset, built straight from the arena blocks so that
+   * hashing it works a word at a time.
+   */
+  boost::dynamic_bitset<> key() const {
+    boost::dynamic_bitset<> key(pruned(), pruned() + blocks_);
+    key.resize(size());
+    return key;
   }
 
  private:
+  void encode_wordlist();
+
+  /**
+   * Compile the inferences made in guess into the checks/masks used to test
+   * encoded words.
+   */
+  static PruneMask compile(const Guess& guess);
+
   /**
-   * Returns the final borrow bit of 2-element-wise x - y.
+   * Double the number of arena slots.
    */
-  static uint64_t borrow_2bit(uint64_t x, uint64_t y);
+  void grow();
 
-  bool should_prune_word(uint32_t encoded_word, uint64_t letter_cts,
-                         uint32_t c_check, uint32_t c_mask,
-                         uint32_t w_check, uint32_t w_mask,
-                         uint64_t min_cts,
-                         uint64_t max_cts, uint64_t max_mask);
+  const uint64_t* pruned() const {
+    return arena_.data() + depth_ * blocks_;
+  }
 
-  void encode_wordlist();
+  uint64_t* pruned() {
+    return arena_.data() + depth_ * blocks_;
+  }
 
   /**
    * For each word, store an encoded representation of the letter + positions,
-   * as well as a 2-bit letter count for each letter and a 'pruned' vector to
+   * as well as a 2-bit letter count for each letter and a 'pruned' bit to
    * denote whether a word should be considered pruned from the dataset.
+   *
+   * The pruned bitsets live in a single arena with one slot of blocks_ words
+   * per search depth, so pushing/popping a prune is just moving depth_.
    */
-  std::vector<bool>* pruned_;
-  std::stack<std::vector<bool>*> pruned_stack_;
+  const PruneMode mode_;
+
+  const ConstraintIndex index_;
+
+  const size_t blocks_;
+  std::vector<uint64_t> arena_;
+  size_t depth_ = 0;
 
+  /**
+   * Number of unpruned words in each arena slot, and their indices as slots
+   * of size() entries (only the first live_[d] of slot d are valid).
+   */
+  std::vector<size_t> live_;
+  std::vector<uint32_t> live_idx_;
+
+  /**
+   * Encoded words/counts. Slot 0 is the full dictionary. In PRUNE_COMPACT
+   * mode there is one slot per depth like live_idx_, where entry k belongs
+   * to word live(k).
+   */
   std::vector<uint32_t> words_;
   std::vector<uint64_t> counts_;
+
+  // Kernel output when pruning a compacted slot, one bit per entry
+  std::vector<uint64_t> prune_bits_;
 };
 
 
@@ -98,10 +177,118 @@ class Dictionary {
 //  return std::vector<bool>(*pruned_);
 //}
 
-std::vector<bool>* Dictionary::prune(const Guess& guess) {
-  pruned_ = new std::vector<bool>(*pruned_); // old reference still in stack
-  pruned_stack_.push(pruned_);
+const uint64_t* Dictionary::prune(const Guess& guess) {
+  return prune(compile(guess));
+}
+
+const uint64_t* Dictionary::prune(const PruneMask& m) {
+  if (depth_ + 2 > live_.size()) {
+    grow();
+  }
+
+  /**
+   * Prune wordset.
+   *
+   * The checks in m are all branchless, so the kernel runs them over 8 or 16
+   * words at a time (whatever the CPU supports) regardless of whether a word
+   * is already pruned. Pruning is monotonic, so it just ORs in new bits.
+   *
+   * Parent slots stay intact below the new one for pop().
+   */
+  const size_t n = size();
+  const size_t parent_live = count();
+  const uint32_t* parent_idx = &live_idx_[depth_ * n];
+  if (mode_ != PRUNE_COMPACT) {
+    std::copy_n(pruned(), blocks_, pruned() + blocks_);
+  }
+  ++depth_;
+
+  uint64_t* bits = pruned();
+  uint32_t* idx = &live_idx_[depth_ * n];
+  size_t live = 0;
+
+  if (mode_ == PRUNE_COMPACT) {
+    // Only check the parent's survivors, writing ours to the new slot
+    const uint32_t* parent_words = &words_[(depth_ - 1) * n];
+    const uint64_t* parent_counts = &counts_[(depth_ - 1) * n];
+    uint32_t* words = &words_[depth_ * n];
+    uint64_t* counts = &counts_[depth_ * n];
+
+    const size_t parent_blocks = (parent_live + 63) / 64;
+    std::fill_n(prune_bits_.begin(), parent_blocks, 0);
+    prune_words(m, parent_words, parent_counts, parent_live,
+                prune_bits_.data());
+
+    // Everything but our survivors is pruned, so rebuild the bitset from
+    // them rather than setting a bit per pruned word
+    std::fill_n(bits, blocks_, ~(uint64_t) 0);
+    for (size_t b = 0; b < parent_blocks; ++b) {
+      uint64_t kept = ~prune_bits_[b];
+      if (64 * (b + 1) > parent_live) {
+        kept &= ((uint64_t) 1 << (parent_live % 64)) - 1;
+      }
+      for (; kept; kept &= kept - 1) {
+        size_t k = 64 * b + (size_t) __builtin_ctzll(kept);
+        uint32_t i = parent_idx[k];
+        bits[i / 64] ^= (uint64_t) 1 << (i % 64);
+        words[live] = parent_words[k];
+        counts[live] = parent_counts[k];
+        idx[live] = i;
+        ++live;
+      }
+    }
+    if (n % 64) {
+      bits[blocks_ - 1] &= ((uint64_t) 1 << (n % 64)) - 1;
+    }
+  } else {
+    if (mode_ == PRUNE_INDEX) {
+      index_.prune(m, bits);
+    } else {
+      prune_words(m, words_.data(), counts_.data(), n, bits);
+    }
+
+    for (size_t b = 0; b < blocks_; ++b) {
+      uint64_t unpruned = ~bits[b];
+      if (64 * (b + 1) > n) {
+        unpruned &= ((uint64_t) 1 << (n % 64)) - 1;
+      }
+      for (; unpruned; unpruned &= unpruned - 1) {
+        idx[live++] = (uint32_t) (64 * b + (size_t) __builtin_ctzll(unpruned));
+      }
+    }
+  }
+  live_[depth_] = live;
+
+  return bits;
+}
+
+void Dictionary::pop() {
+  assert(depth_ > 0);
+  --depth_;
+}
+
+boost::dynamic_bitset<> Dictionary::matching(const Guess& guess) const {
+  std::vector<uint64_t> pruned(blocks_, 0);
+  index_.prune(compile(guess), pruned.data());
+
+  boost::dynamic_bitset<> matches(pruned.begin(), pruned.end());
+  matches.resize(size());
+  return ~matches;
+}
 
+size_t Dictionary::size() const {
+  return reference_words.size();
+}
+
+size_t Dictionary::count() const {
+  return live_[depth_];
+}
+
+/**
+ * Private implementations
+ */
+
+PruneMask Dictionary::compile(const Guess& guess) {
   /**
    * Prune based on correct placements.
    * Anything that does not match all correct placements will be pruned.
@@ -115,12 +302,10 @@ std::vector<bool>* Dictionary::prune(const Guess& guess) {
    *
    *  any bits mean there was a mismatch => prune
    */
-  // TODO consider caching check+mask in Dictionary
-  uint32_t c_check = 0;
-  uint32_t c_mask = 0;
+  PruneMask m;
   for (const auto& [pos, l] : guess.correct_placements) {
-    c_check |= ((uint32_t) l - 'a') << BITS_PER_LETTER * pos;
-    c_mask |= (uint32_t) 0b11111 << BITS_PER_LETTER * pos;
+    m.c_check |= ((uint32_t) l - 'a') << BITS_PER_LETTER * pos;
+    m.c_mask |= (uint32_t) 0b11111 << BITS_PER_LETTER * pos;
   }
 
   //std::cout << std::bitset<32>(c_check) << std::endl;
@@ -142,11 +327,9 @@ std::vector<bool>* Dictionary::prune(const Guess& guess) {
    *
    *  if any block == 00000, there was a match => prune
    */
-  uint32_t w_check = 0;
-  uint32_t w_mask = 0xFFFFFFFF;
   for (const auto& [pos, l] : guess.wrong_placements) {
-    w_check |= ((uint32_t) l - 'a') << BITS_PER_LETTER * pos;
-    w_mask ^= (uint32_t) 0b11111 << BITS_PER_LETTER * pos;
+    m.w_check |= ((uint32_t) l - 'a') << BITS_PER_LETTER * pos;
+    m.w_mask ^= (uint32_t) 0b11111 << BITS_PER_LETTER * pos;
   }
 
   /**
@@ -168,9 +351,8 @@ std::vector<bool>* Dictionary::prune(const Guess& guess) {
    *
    * If any 1s, then the result of the subtraction is negative => prune
    */
-  uint64_t min_cts = 0;
   for (const auto& [l, ct] : guess.min_letter_counts) {
-    min_cts |= (uint64_t) ct << BITS_PER_COUNT * ((uint8_t) l - 'a');
+    m.min_cts |= (uint64_t) ct << BITS_PER_COUNT * ((uint8_t) l - 'a');
   }
 
   /**
@@ -181,121 +363,25 @@ std::vector<bool>* Dictionary::prune(const Guess& guess) {
    * sign bit of:
    * max_letter_ct - (count)
    */
-  uint64_t max_cts = 0;
-  uint64_t max_mask = 0;
   for (const auto& [l, ct] : guess.max_letter_counts) {
-    max_cts |= (uint64_t) ct << BITS_PER_COUNT * ((uint8_t) l - 'a');
-    max_mask |= (uint64_t) 0b11 << BITS_PER_COUNT * ((uint8_t) l - 'a');
+    m.max_cts |= (uint64_t) ct << BITS_PER_COUNT * ((uint8_t) l - 'a');
+    m.max_mask |= (uint64_t) 0b11 << BITS_PER_COUNT * ((uint8_t) l - 'a');
   }
 
-  // Prune wordset
-  for (size_t i = 0; i < pruned_->size(); ++i) {
-    if (pruned_->at(i)) {
-      // This element is already pruned, skip.
-      continue;
-    }
-
-    const uint32_t encoded_word = words_[i];
-    const uint64_t letter_cts = counts_[i];
-
-    pruned_->at(i) = should_prune_word(encoded_word, letter_cts,
-                                             c_check, c_mask,
-                                             w_check, w_mask,
-                                             min_cts,
-                                             max_cts, max_mask);
-  }
-
-  return pruned_;
-}
-
-void Dictionary::pop() {
-  delete pruned_;
-  pruned_stack_.pop();
-  pruned_ = pruned_stack_.top();
+  return m;
 }
 
-size_t Dictionary::size() const {
-  return reference_words.size();
-}
-
-size_t Dictionary::count() const {
-  // TODO optimize with saved var
-  size_t sum = 0;
-  for (bool p : *pruned_) {
-    sum += !p;
+void Dictionary::grow() {
+  arena_.resize(2 * arena_.size());
+  live_.resize(2 * live_.size());
+  live_idx_.resize(2 * live_idx_.size());
+  if (mode_ == PRUNE_COMPACT) {
+    words_.resize(live_idx_.size());
+    counts_.resize(live_idx_.size());
   }
-  return sum;
-}
-
-/**
- * Private implementations
- */
-
-uint64_t Dictionary::borrow_2bit(uint64_t x, uint64_t y) {
-  // Get LSB borrow bit
-  /**
-   * This matches any 0/1 x/y pairs in the first digit.
-   */
-  uint64_t tmp = (~x & y);
-  uint64_t b_in = LSB_MASK & tmp;
-
-  /**
-   * This matches any 0/1 pairs in the second digit:
-   *     (~x & y)
-   *   OR
-   * any matching digits
-   *     ~(x ^ y)
-   *   with a borrow bit from the previous digit:
-   *     (b_in << 1)
-   */
-  return MSB_MASK & (tmp | ((b_in << 1) & ~(x ^ y)));
-}
-
-bool Dictionary::should_prune_word(uint32_t encoded_word, uint64_t letter_cts,
-                                   uint32_t c_check, uint32_t c_mask,
-                                   uint32_t w_check, uint32_t w_mask,
-                                   uint64_t min_cts,
-                                   uint64_t max_cts, uint64_t max_mask) {
-
-
-    // Check correct placements
-    uint32_t c_result = (c_check ^ encoded_word) & c_mask;
-    if (c_result) {
-      //std::cout << "Pruned for not having correct placements." << std::endl;
-      return true;
-    }
-
-    // Check wrong placements
-    uint32_t w_result = (w_check ^ encoded_word) | w_mask;
-    for (uint8_t pos = 0; pos < NUM_LETTERS; ++pos) {
-      uint8_t block = (w_result >> BITS_PER_LETTER * pos) & 0b11111;
-      if (!block) {
-        //std::cout << "Pruned for having wrong placement." << std::endl;
-        return true;
-      }
-    }
-
-    // Check min letter count
-    uint64_t min_result = borrow_2bit(letter_cts, min_cts);
-    if (min_result) {
-      //std::cout << "Pruned for not meeting min letters." << std::endl;
-      return true;
-    }
-
-    // Check max letter count
-    uint64_t max_result = max_mask & borrow_2bit(max_cts, letter_cts);
-    if (max_result) {
-      //std::cout << "Pruned for having over max letters." << std::endl;
-      return true;
-    }
-
-    return false;
 }
 
 void Dictionary::encode_wordlist() {
-  pruned_ = new std::vector<bool>(reference_words.size(), false);
-  pruned_stack_.push(pruned_);
-
   for (std::string word : reference_words) {
     /**
      * Encode word as a sequence of five 5-bit numbers
@@ -331,6 +417,14 @@ void Dictionary::encode_wordlist() {
     }
     counts_.push_back(encoded_count);
   }
+
+  for (size_t i = 0; i < reference_words.size(); ++i) {
+    live_idx_[i] = (uint32_t) i;
+  }
+  if (mode_ == PRUNE_COMPACT) {
+    words_.resize(live_idx_.size());
+    counts_.resize(live_idx_.size());
+  }
 }
 
 #endif
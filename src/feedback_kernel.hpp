@@ -0,0 +1,103 @@
+#ifndef FEEDBACK_KERNEL_H
+#define FEEDBACK_KERNEL_H
+
+#include "constants.hpp"
+#include "guess_pair.hpp"
+#include "simd.hpp"
+
+#include <stdint.h>
+
+/**
+ * Scalar reference kernel, also used for the tail of the vector kernel.
+ */
+void feedback_codes_scalar(const uint8_t* guess, const uint8_t* const* columns,
+                           size_t begin, size_t end, uint8_t* codes) {
+  for (size_t j = begin; j < end; ++j) {
+    const uint8_t solution[5] = {
+      columns[0][j], columns[1][j], columns[2][j], columns[3][j], columns[4][j],
+    };
+    codes[j] = feedback_code(guess, solution);
+  }
+}
+
+#ifdef SIMD_X86
+
+/**
+ * 32 solutions per iteration, one byte lane each.
+ *
+ * For a fixed guess, letter i is yellow iff it is not green and
+ *   rank_i = #{ j <= i : guess[j] == guess[i], j not green }
+ * is at most
+ *   avail_i = #{ k : solution[k] == guess[i], k not green },
+ * which is exactly the left-to-right yellow assignment of feedback_code. All
+ * of these are counts of byte compares, so they vectorize across solutions.
+ */
+__attribute__((target("avx2")))
+void feedback_codes_avx2(const uint8_t* guess, const uint8_t* const* columns,
+                         size_t n, uint8_t* codes) {
+  const __m256i ones = _mm256_set1_epi8(-1);
+
+  __m256i g[5];
+  for (size_t i = 0; i < 5; ++i) {
+    g[i] = _mm256_set1_epi8((char) guess[i]);
+  }
+
+  size_t j = 0;
+  for (; j + 32 <= n; j += 32) {
+    __m256i s[5];
+    __m256i green[5];
+    __m256i code = _mm256_setzero_si256();
+    for (size_t i = 0; i < 5; ++i) {
+      s[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(columns[i] + j));
+      green[i] = _mm256_cmpeq_epi8(s[i], g[i]);
+      code = _mm256_add_epi8(code, _mm256_and_si256(
+            green[i], _mm256_set1_epi8((char) (GREEN * PATTERN_WEIGHTS[i]))));
+    }
+
+    for (size_t i = 0; i < 5; ++i) {
+      // Compare masks are -1 per match, so subtracting them counts up
+      __m256i avail = _mm256_setzero_si256();
+      for (size_t k = 0; k < 5; ++k) {
+        avail = _mm256_sub_epi8(avail, _mm256_andnot_si256(
+              green[k], _mm256_cmpeq_epi8(s[k], g[i])));
+      }
+
+      __m256i rank = _mm256_setzero_si256();
+      for (size_t k = 0; k <= i; ++k) {
+        if (guess[k] == guess[i]) {
+          rank = _mm256_sub_epi8(rank, _mm256_andnot_si256(green[k], ones));
+        }
+      }
+
+      __m256i yellow = _mm256_andnot_si256(
+          _mm256_or_si256(green[i], _mm256_cmpgt_epi8(rank, avail)), ones);
+      code = _mm256_add_epi8(code, _mm256_and_si256(
+            yellow, _mm256_set1_epi8((char) (YELLOW * PATTERN_WEIGHTS[i]))));
+    }
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(codes + j), code);
+  }
+
+  feedback_codes_scalar(guess, columns, j, n, codes);
+}
+
+#endif
+
+/**
+ * Batched feedback for one guess against a block of solutions.
+ *
+ * Solutions are passed as structure-of-arrays: columns[pos][j] is letter pos
+ * (0-25) of solution j. Writes the pattern code of guess vs. each solution j
+ * in [0, n) to codes[j].
+ */
+void feedback_codes(const uint8_t* guess, const uint8_t* const* columns,
+                    size_t n, uint8_t* codes) {
+#ifdef SIMD_X86
+  if (simd_level() >= SIMD_AVX2) {
+    return feedback_codes_avx2(guess, columns, n, codes);
+  }
+#endif
+  feedback_codes_scalar(guess, columns, 0, n, codes);
+}
+
+#endif
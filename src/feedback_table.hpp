@@ -0,0 +1,105 @@
+#ifndef FEEDBACK_TABLE_H
+#define FEEDBACK_TABLE_H
+
+#include "constants.hpp"
+#include "guess_pair.hpp"
+#include "guess_pair_index.hpp"
+#include "prune_kernel.hpp"
+#include "thread_pool.hpp"
+
+#include <string>
+#include <vector>
+
+/**
+ * Pattern codes of a wordlist against itself, along with the PruneMask each
+ * (guess, code) pair compiles to.
+ *
+ * Replaces building a Guess per guess-solution pair: a prune is two array
+ * lookups and a Dictionary::prune(mask). The codes are the GuessPairIndex
+ * matrix, so there's one code table however the words are solved.
+ */
+class FeedbackTable {
+ public:
+  FeedbackTable(const std::vector<std::string>& wordlist)
+    : pairs_(wordlist) {
+    index();
+  }
+
+  FeedbackTable(const FeedbackTable&) = delete;
+
+  uint8_t code(size_t g, size_t s) const {
+    return pairs_.code(g, s);
+  }
+
+  const PruneMask& mask(size_t g, uint8_t code) const {
+    return masks_[g * NUM_PATTERNS + code];
+  }
+
+ private:
+  void index();
+
+  /**
+   * Compile the constraints of guessing guess and getting code back, with
+   * the same inferences as Guess::infer.
+   */
+  static PruneMask compile(const uint8_t* guess, uint8_t code);
+
+  const GuessPairIndex pairs_;
+
+  // guesses x NUM_PATTERNS masks, row-major by guess
+  std::vector<PruneMask> masks_;
+};
+
+void FeedbackTable::index() {
+  masks_.resize(pairs_.guesses() * NUM_PATTERNS);
+
+  // Each guess only writes its own masks
+  parallel_for(pairs_.guesses(), [&](size_t g) {
+    const uint8_t* letters = pairs_.guess_letters(g);
+    for (size_t code = 0; code < NUM_PATTERNS; ++code) {
+      masks_[g * NUM_PATTERNS + code] = compile(letters, (uint8_t) code);
+    }
+  }, 16);
+}
+
+PruneMask FeedbackTable::compile(const uint8_t* guess, uint8_t code) {
+  PruneMask m;
+  uint8_t min_counts[26] = {0};
+  bool greyed[26] = {false};
+
+  for (size_t pos = 0; pos < 5; ++pos) {
+    const uint8_t l = guess[pos];
+    const uint8_t colour = code % 3;
+    code /= 3;
+
+    if (colour == GREEN) {
+      m.c_check |= (uint32_t) l << BITS_PER_LETTER * pos;
+      m.c_mask |= (uint32_t) 0b11111 << BITS_PER_LETTER * pos;
+      ++min_counts[l];
+    } else {
+      // Yellows and greys are both wrong placements
+      m.w_check |= (uint32_t) l << BITS_PER_LETTER * pos;
+      m.w_mask ^= (uint32_t) 0b11111 << BITS_PER_LETTER * pos;
+      if (colour == YELLOW) {
+        ++min_counts[l];
+      } else {
+        greyed[l] = true;
+      }
+    }
+  }
+
+  for (size_t l = 0; l < 26; ++l) {
+    m.min_cts |= (uint64_t) min_counts[l] << BITS_PER_COUNT * l;
+
+    // A grey means we guessed more of l than the solution has, so the
+    // green/yellow count is exact
+    if (greyed[l]) {
+      m.max_cts |= (uint64_t) min_counts[l] << BITS_PER_COUNT * l;
+      m.max_mask |= (uint64_t) 0b11 << BITS_PER_COUNT * l;
+    }
+  }
+
+  return m;
+}
+
+#endif
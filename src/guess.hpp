@@ -121,11 +121,11 @@ void Guess::set(const std::string& colors) {
   for (uint8_t i = 0; i < NUM_LETTERS; ++i) {
     char c = colors[i];
     if (c == 'g') {
-      greens_[i] = c;
+      greens_[i] = word_[i];
     } else if (c == 'y') {
-      yellows_[i] = c;
+      yellows_[i] = word_[i];
     } else if (c == 'x') {
-      greys_[i] = c;
+      greys_[i] = word_[i];
     } else {
       std::cerr << "Invalid character " << c << std::endl;
       assert(false);
@@ -5,10 +5,91 @@
 #include "word.hpp"
 
 #include <bitset>
+#include <string>
 
 const uint8_t YELLOW = 0b01;
 const uint8_t GREEN = 0b10;
 
+/**
+ * Feedback patterns as base-3 codes where digit i is the colour of letter i
+ * (0 for grey, YELLOW, GREEN), i.e. the same values as the 2-bit colours of a
+ * guess id.
+ */
+const size_t NUM_PATTERNS = 243;
+const uint8_t ALL_GREEN = 242;
+const uint8_t PATTERN_WEIGHTS[5] = {1, 3, 9, 27, 81};
+
+/**
+ * Pattern code for guess against solution, given as their 5 letters (0-25).
+ * Duplicate letters follow the same rules as GuessPair::compute_id.
+ */
+uint8_t feedback_code(const uint8_t* guess, const uint8_t* solution) {
+  // Solution letters not matched by a green, available for yellows
+  uint8_t unplaced[26] = {0};
+  for (uint8_t i = 0; i < 5; ++i) {
+    if (guess[i] != solution[i]) {
+      ++unplaced[solution[i]];
+    }
+  }
+
+  uint8_t code = 0;
+  for (uint8_t i = 0; i < 5; ++i) {
+    if (guess[i] == solution[i]) {
+      code = (uint8_t) (code + GREEN * PATTERN_WEIGHTS[i]);
+    } else if (unplaced[guess[i]]) {
+      --unplaced[guess[i]];
+      code = (uint8_t) (code + YELLOW * PATTERN_WEIGHTS[i]);
+    }
+  }
+  return code;
+}
+
+/**
+ * Pattern code for feedback given as one of 'g', 'y' or 'x' (grey) per
+ * letter, as in Guess::set. Returns false if colors isn't valid feedback.
+ */
+bool parse_feedback(const std::string& colors, uint8_t& code) {
+  if (colors.size() != NUM_LETTERS) {
+    return false;
+  }
+
+  code = 0;
+  for (uint8_t i = 0; i < NUM_LETTERS; ++i) {
+    if (colors[i] == 'g') {
+      code = (uint8_t) (code + GREEN * PATTERN_WEIGHTS[i]);
+    } else if (colors[i] == 'y') {
+      code = (uint8_t) (code + YELLOW * PATTERN_WEIGHTS[i]);
+    } else if (colors[i] != 'x') {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * The letter bits of a guess id, given the guess's 5 letters (0-25).
+ */
+uint64_t letters_id(const uint8_t* letters) {
+  uint64_t id = 0;
+  for (uint8_t i = 0; i < 5; ++i) {
+    id |= (uint64_t) letters[i] << 7*i;
+  }
+  return id;
+}
+
+/**
+ * The colour bits of a guess id for a pattern code, to OR with the letter bits
+ * of the guess.
+ */
+uint64_t pattern_id(uint8_t code) {
+  uint64_t id = 0;
+  for (uint8_t i = 0; i < 5; ++i) {
+    id |= (uint64_t) (code % 3) << (7*i + 5);
+    code /= 3;
+  }
+  return id;
+}
+
 class GuessPair {
  public:
   GuessPair(const Word& g, const Word& s) {
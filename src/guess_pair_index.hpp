@@ -1,59 +1,191 @@
 #ifndef GUESS_PAIR_INDEX_H
 #define GUESS_PAIR_INDEX_H
 
+#include "feedback_kernel.hpp"
 #include "guess_pair.hpp"
+#include "thread_pool.hpp"
 #include "word.hpp"
 
 /**
- * Precompute the guess-pair ids for all guess-pairs in the given wordlist.
+ * Precompute the guess-pair ids for all guess-pairs of a guess list against
+ * an answer list (the same list for a square index).
+ *
+ * Stored as a dense row-major matrix of one-byte pattern codes, one row per
+ * guess and one column per answer. The full 64-bit id of a pair is the
+ * guess's letter bits (kept per row) ORed with the colour bits of its code.
+ *
+ * Without stored codes, codes are scored on demand instead, and the index
+ * takes memory linear in the word lists.
  */
 class GuessPairIndex {
  public:
-  GuessPairIndex(const std::vector<std::string>& wordlist) {
-    index(wordlist);
+  GuessPairIndex(const std::vector<std::string>& wordlist)
+    : GuessPairIndex(wordlist, wordlist) {}
+
+  GuessPairIndex(const std::vector<std::string>& guesses,
+                 const std::vector<std::string>& answers,
+                 bool store_codes = true) {
+    index(guesses, answers);
+    if (store_codes) {
+      this->store_codes();
+    }
   }
 
   GuessPairIndex(const GuessPairIndex&) = delete;
   GuessPairIndex(GuessPairIndex&&) = default;
 
-  const std::vector<uint64_t>& operator[](size_t i) const {
-    return guess_index_[i];
+  /**
+   * Pattern code of guess i against solution j.
+   */
+  uint8_t code(size_t i, size_t j) const {
+    if (stored()) {
+      return codes_[i * n_answers_ + j];
+    }
+    const uint8_t solution[5] = {
+      letters_[0][j], letters_[1][j], letters_[2][j], letters_[3][j], letters_[4][j],
+    };
+    return feedback_code(guess_letters(i), solution);
+  }
+
+  /**
+   * Pattern codes of guess i against every solution. Codes must be stored.
+   */
+  const uint8_t* row(size_t i) const {
+    assert(stored());
+    return &codes_[i * n_answers_];
+  }
+
+  /**
+   * Pattern codes of guess i against every solution: the stored row, or
+   * scored into buffer (of answers() bytes) if codes aren't stored.
+   */
+  const uint8_t* row(size_t i, uint8_t* buffer) const {
+    if (stored()) {
+      return row(i);
+    }
+    answer_codes(guess_letters(i), buffer);
+    return buffer;
+  }
+
+  /**
+   * Score every pair and keep the codes, if not already kept.
+   */
+  void store_codes();
+
+  bool stored() const {
+    return !codes_.empty();
+  }
+
+  /**
+   * Letters (0-25) of guess i.
+   */
+  const uint8_t* guess_letters(size_t i) const {
+    return guess_words_[i].get_letters();
+  }
+
+  /**
+   * Guess-pair id of guess i against solution j.
+   */
+  uint64_t gid(size_t i, size_t j) const {
+    return guess_ids_[i] | pattern_ids_[code(i, j)];
+  }
+
+  /**
+   * Pattern codes of any guess (letters 0-25) against every answer, for
+   * guesses that aren't in the index.
+   */
+  void answer_codes(const uint8_t* guess, uint8_t* codes) const {
+    const uint8_t* columns[5] = {
+      letters_[0].data(), letters_[1].data(), letters_[2].data(),
+      letters_[3].data(), letters_[4].data(),
+    };
+    feedback_codes(guess, columns, n_answers_, codes);
   }
 
   size_t size() const {
     return size_;
   }
 
+  size_t guesses() const {
+    return n_guesses_;
+  }
+
+  size_t answers() const {
+    return n_answers_;
+  }
+
  private:
-  void index(const std::vector<std::string>& wordlist);
+  void index(const std::vector<std::string>& guesses,
+             const std::vector<std::string>& answers);
+
+  std::vector<Word> guess_words_;
+  std::vector<Word> answer_words_;
 
-  std::vector<Word> words_;
+  // Letters of each answer as structure-of-arrays, letters_[pos][j]
+  std::vector<uint8_t> letters_[5];
 
-  std::vector<std::vector<uint64_t>> guess_index_;
+  // guesses x answers pattern codes, row-major by guess, or empty if not
+  // stored
+  std::vector<uint8_t> codes_;
 
+  // Letter bits of each guess's ids, and colour bits of each pattern code
+  std::vector<uint64_t> guess_ids_;
+  uint64_t pattern_ids_[NUM_PATTERNS];
+
+  size_t n_guesses_ = 0;
+  size_t n_answers_ = 0;
   size_t size_ = 0;
 };
 
-void GuessPairIndex::index(const std::vector<std::string>& wordlist) {
-  size_t subsize = wordlist.size();
+void GuessPairIndex::index(const std::vector<std::string>& guesses,
+                           const std::vector<std::string>& answers) {
+  n_guesses_ = guesses.size();
+  n_answers_ = answers.size();
+
+  guess_words_.reserve(n_guesses_);
+  for (std::string w : guesses) {
+    guess_words_.push_back(Word(w));
+  }
+  answer_words_.reserve(n_answers_);
+  for (std::string w : answers) {
+    answer_words_.push_back(Word(w));
+  }
+
+  for (size_t pos = 0; pos < 5; ++pos) {
+    letters_[pos].resize(n_answers_);
+    for (size_t j = 0; j < n_answers_; ++j) {
+      letters_[pos][j] = answer_words_[j].get_letters()[pos];
+    }
+  }
 
-  words_.reserve(subsize);
-  for (std::string w : wordlist) {
-    words_.push_back(Word(w));
+  for (size_t code = 0; code < NUM_PATTERNS; ++code) {
+    pattern_ids_[code] = pattern_id((uint8_t) code);
   }
 
-  guess_index_.resize(subsize);
+  guess_ids_.resize(n_guesses_);
+  for (size_t i = 0; i < n_guesses_; ++i) {
+    guess_ids_[i] = letters_id(guess_words_[i].get_letters());
+  }
 
-  for (size_t i = 0; i < subsize; ++i) {
-    guess_index_[i].resize(subsize);
+  size_ = n_guesses_ * n_answers_;
+}
 
-    for (size_t j = 0; j < subsize; ++j) {
-      GuessPair gp(words_[i], words_[j]);
-      guess_index_[i][j] = gp.id();
-    }
+void GuessPairIndex::store_codes() {
+  if (stored() || !size_) {
+    return;
   }
+  codes_.resize(size_);
 
-  size_ = subsize * subsize;
+  // Rows only write to their own slice, so they can go to any thread
+  parallel_for(n_guesses_, [&](size_t i) {
+    // Score this guess against every solution at once
+    answer_codes(guess_words_[i].get_letters(), &codes_[i * n_answers_]);
+
+    // The batched kernel must agree with the pairwise reference
+    for (size_t j = 0; j < n_answers_; ++j) {
+      assert(gid(i, j) == GuessPair(guess_words_[i], answer_words_[j]).id());
+    }
+  }, 16);
 }
 
 #endif
@@ -0,0 +1,102 @@
+#ifndef LRU_CACHE_H
+#define LRU_CACHE_H
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+/**
+ * Thread-safe least-recently-used cache bounded by a total cost (e.g. bytes).
+ *
+ * Values are handed out as shared_ptr, so a reader keeps its value alive even
+ * if another thread evicts it in the meantime. Values are built outside the
+ * lock: two threads missing on the same key may both build it, and the first
+ * one stored wins.
+ */
+template <typename K, typename V>
+class LruCache {
+ public:
+  LruCache(size_t capacity)
+    : capacity_(capacity) {}
+
+  LruCache(const LruCache&) = delete;
+
+  /**
+   * Cached value for key, or nullptr on a miss.
+   */
+  std::shared_ptr<const V> get(const K& key);
+
+  /**
+   * Insert value (unless key is already present) and return the cached value,
+   * evicting least recently used entries to stay under capacity. The newest
+   * entry is always kept, even if it alone exceeds capacity.
+   */
+  std::shared_ptr<const V> put(const K& key, std::shared_ptr<const V> value,
+                               size_t cost);
+
+  size_t cost() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return cost_;
+  }
+
+  size_t size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+  }
+
+ private:
+  struct Entry {
+    K key;
+    std::shared_ptr<const V> value;
+    size_t cost;
+  };
+
+  const size_t capacity_;
+
+  mutable std::mutex mutex_;
+
+  // Most recently used first
+  std::list<Entry> entries_;
+  std::unordered_map<K, typename std::list<Entry>::iterator> lookup_;
+  size_t cost_ = 0;
+};
+
+template <typename K, typename V>
+std::shared_ptr<const V> LruCache<K, V>::get(const K& key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = lookup_.find(key);
+  if (it == lookup_.end()) {
+    return nullptr;
+  }
+  entries_.splice(entries_.begin(), entries_, it->second);
+  return it->second->value;
+}
+
+template <typename K, typename V>
+std::shared_ptr<const V> LruCache<K, V>::put(const K& key,
+                                             std::shared_ptr<const V> value,
+                                             size_t cost) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = lookup_.find(key);
+  if (it != lookup_.end()) {
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return it->second->value;
+  }
+
+  entries_.push_front({key, std::move(value), cost});
+  lookup_.insert({key, entries_.begin()});
+  cost_ += cost;
+
+  while (cost_ > capacity_ && entries_.size() > 1) {
+    const Entry& last = entries_.back();
+    cost_ -= last.cost;
+    lookup_.erase(last.key);
+    entries_.pop_back();
+  }
+
+  return entries_.front().value;
+}
+
+#endif
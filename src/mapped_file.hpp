@@ -0,0 +1,95 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <stdint.h>
+
+#include <string>
+#include <utility>
+
+/**
+ * Read-only memory mapping of a whole file.
+ *
+ * Pages are shared with the page cache, so every process mapping the same
+ * file shares one copy of it.
+ */
+class MappedFile {
+ public:
+  MappedFile() {}
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  MappedFile(MappedFile&& other)
+    : data_(std::exchange(other.data_, nullptr)),
+      size_(std::exchange(other.size_, 0)) {}
+
+  MappedFile& operator=(MappedFile&& other) {
+    std::swap(data_, other.data_);
+    std::swap(size_, other.size_);
+    return *this;
+  }
+
+  ~MappedFile() {
+    close();
+  }
+
+  /**
+   * Map filename, returning false if it can't be opened or is empty.
+   */
+  bool open(const std::string& filename);
+
+  void close();
+
+  const uint8_t* data() const {
+    return data_;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+ private:
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+bool MappedFile::open(const std::string& filename) {
+  close();
+
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    ::close(fd);
+    return false;
+  }
+
+  void* data = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  // The mapping holds its own reference to the file
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+
+  data_ = static_cast<const uint8_t*>(data);
+  size_ = (size_t) st.st_size;
+  return true;
+}
+
+void MappedFile::close() {
+  if (data_) {
+    munmap(const_cast<uint8_t*>(data_), size_);
+  }
+  data_ = nullptr;
+  size_ = 0;
+}
+
+#endif
@@ -0,0 +1,131 @@
+#ifndef PARTITION_SET_H
+#define PARTITION_SET_H
+
+#include "constants.hpp"
+#include "prune_index.hpp"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * The distinct ways guesses split a fixed set of answers by pattern.
+ *
+ * With two or more answers, a guess is worth exactly as much as any other
+ * guess splitting them the same way, even if only one of the two is an
+ * answer: the other buckets need two or more guesses anyway. A guess whose
+ * partition another refines is worth no less than it, as each of its buckets
+ * holds one of the other's.
+ */
+class PartitionSet {
+ public:
+  /**
+   * Partitions of the unpruned answers, which must outlive the set.
+   * Refinement is only checked with at most max_refine of them, as it's
+   * linear in the partitions held.
+   */
+  PartitionSet(const PruneIndex& pindex, const boost::dynamic_bitset<>& pruned,
+               size_t max_refine);
+
+  PartitionSet(const PartitionSet&) = delete;
+
+  /**
+   * Add the partition made by g_idx, returning false if it's the same as or
+   * coarser than one already held.
+   */
+  bool insert(size_t g_idx);
+
+ private:
+  /**
+   * Whether partition p refines the given labels.
+   */
+  bool refines(size_t p, const uint8_t* labels) const;
+
+  const PruneIndex& pindex_;
+  const boost::dynamic_bitset<>& pruned_;
+  const size_t max_refine_;
+  // Gathered on the first insert, as most states never get that far
+  std::vector<size_t> answers_;
+  bool refine_ = false;
+
+  // Each partition as the bucket of every answer, numbered in order of first
+  // appearance so equal partitions get equal labels
+  std::vector<uint8_t> labels_;
+  std::vector<size_t> buckets_;
+  // Partition by hash of its labels
+  std::unordered_map<uint64_t, size_t> by_hash_;
+};
+
+PartitionSet::PartitionSet(const PruneIndex& pindex,
+                           const boost::dynamic_bitset<>& pruned,
+                           size_t max_refine)
+  : pindex_(pindex), pruned_(pruned), max_refine_(max_refine) {}
+
+bool PartitionSet::insert(size_t g_idx) {
+  if (answers_.empty()) {
+    for (size_t s_idx = 0; s_idx < pruned_.size(); ++s_idx) {
+      if (!pruned_[s_idx]) {
+        answers_.push_back(s_idx);
+      }
+    }
+    refine_ = answers_.size() <= max_refine_;
+  }
+
+  const size_t n = answers_.size();
+  const size_t offset = labels_.size();
+  labels_.resize(offset + n);
+  uint8_t* labels = &labels_[offset];
+
+  int label_of[NUM_PATTERNS];
+  std::fill(label_of, label_of + NUM_PATTERNS, -1);
+  size_t buckets = 0;
+  uint64_t hash = 0xcbf29ce484222325;
+  for (size_t k = 0; k < n; ++k) {
+    const uint8_t code = pindex_.code(g_idx, answers_[k]);
+    if (label_of[code] < 0) {
+      label_of[code] = (int) buckets++;
+    }
+    labels[k] = (uint8_t) label_of[code];
+    hash = (hash ^ labels[k]) * 0x100000001b3;
+  }
+
+  bool held = false;
+  auto found = by_hash_.find(hash);
+  if (found != by_hash_.end()) {
+    held = memcmp(&labels_[found->second * n], labels, n) == 0;
+  }
+  for (size_t p = 0; refine_ && !held && p < buckets_.size(); ++p) {
+    held = buckets_[p] > buckets && refines(p, labels);
+  }
+  if (held) {
+    labels_.resize(offset);
+    return false;
+  }
+
+  // A hash collision with a different partition keeps the first in by_hash_
+  by_hash_.emplace(hash, buckets_.size());
+  buckets_.push_back(buckets);
+  return true;
+}
+
+bool PartitionSet::refines(size_t p, const uint8_t* labels) const {
+  const size_t n = answers_.size();
+  const uint8_t* fine = &labels_[p * n];
+
+  // The coarse bucket each fine bucket falls in
+  int coarse_of[NUM_PATTERNS];
+  std::fill(coarse_of, coarse_of + buckets_[p], -1);
+  for (size_t k = 0; k < n; ++k) {
+    if (coarse_of[fine[k]] < 0) {
+      coarse_of[fine[k]] = labels[k];
+    } else if (coarse_of[fine[k]] != labels[k]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+#endif
@@ -0,0 +1,397 @@
+#ifndef PINDEX_FILE_H
+#define PINDEX_FILE_H
+
+#include "constants.hpp"
+#include "mapped_file.hpp"
+#include "survivor_set.hpp"
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * Version 2 .pindex layout, all fields little endian:
+ *
+ *   [0, 64)        PindexHeader
+ *   [64, ...)      bitsets, each in a 64-byte aligned slot of header.stride
+ *                  bytes, as 64-bit blocks with zeroed padding
+ *   table_offset   n_gids PindexEntry, sorted by gid
+ *
+ * With PINDEX_COMPRESSED set in flags, the slots instead hold variable sized
+ * survivor containers (see survivor_set.hpp), each a whole number of 64-bit
+ * words, and stride is 0.
+ *
+ * The file is mapped read-only and queried in place: a gid is binary searched
+ * in the table, and its bitset blocks are used straight out of the mapping.
+ * The table is written last, so bitsets can be streamed out as they're made.
+ */
+typedef boost::dynamic_bitset<>::block_type pindex_block;
+
+static_assert(sizeof(pindex_block) == sizeof(uint64_t),
+              "pindex bitsets are stored as 64-bit blocks");
+
+const char PINDEX_MAGIC[8] = {'W', 'B', 'P', 'I', 'N', 'D', 'E', 'X'};
+const uint32_t PINDEX_VERSION = 2;
+const size_t PINDEX_ALIGN = 64;
+
+// Header flags
+const uint32_t PINDEX_COMPRESSED = 1;
+
+struct PindexHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t flags;
+  uint64_t n_guesses;
+  uint64_t n_answers;
+  // wordlist_fingerprint of the lists the index was built from
+  uint64_t fingerprint;
+  uint64_t n_gids;
+  // Bytes per bitset slot, a multiple of PINDEX_ALIGN (0 if compressed)
+  uint64_t stride;
+  uint64_t table_offset;
+};
+
+static_assert(sizeof(PindexHeader) == PINDEX_ALIGN, "header fills one slot");
+
+struct PindexEntry {
+  uint64_t gid;
+  // Byte offset of the gid's bitset from the start of the file
+  uint64_t offset;
+};
+
+/**
+ * FNV-1a over both word lists, so an index is only reused with the lists (and
+ * order) it was built from.
+ */
+uint64_t wordlist_fingerprint(const std::vector<std::string>& guesses,
+                              const std::vector<std::string>& answers) {
+  uint64_t hash = 0xcbf29ce484222325;
+  auto mix = [&](const std::string& s) {
+    for (char c : s) {
+      hash = (hash ^ (uint8_t) c) * 0x100000001b3;
+    }
+    // Separator, so ["ab", "c"] and ["a", "bc"] differ
+    hash = (hash ^ 0xff) * 0x100000001b3;
+  };
+
+  for (const std::string& g : guesses) {
+    mix(g);
+  }
+  mix("");
+  for (const std::string& a : answers) {
+    mix(a);
+  }
+  return hash;
+}
+
+/**
+ * Bytes per bitset slot for n_answers bits.
+ */
+size_t pindex_stride(size_t n_answers) {
+  size_t bytes = (n_answers + 63) / 64 * sizeof(uint64_t);
+  return (bytes + PINDEX_ALIGN - 1) / PINDEX_ALIGN * PINDEX_ALIGN;
+}
+
+/**
+ * Writes a v2 .pindex to a seekable stream: bitsets go out as they are added,
+ * through a large buffer, and the sorted gid table and final header on
+ * finish(). Only the table (16 bytes per gid) is kept in memory.
+ */
+class PindexWriter {
+ public:
+  PindexWriter(std::ostream& os, size_t n_guesses, size_t n_answers,
+               uint64_t fingerprint, uint32_t flags = 0);
+
+  PindexWriter(const PindexWriter&) = delete;
+
+  /**
+   * Append the bitset for gid, given as its (n_answers + 63) / 64 blocks.
+   */
+  void add(uint64_t gid, const pindex_block* blocks);
+
+  /**
+   * Append the survivor container for gid, of the given number of words.
+   */
+  void add_compressed(uint64_t gid, const uint64_t* data, size_t words);
+
+  /**
+   * Append gid given its sorted survivors, in whichever form this file holds.
+   */
+  void add_survivors(uint64_t gid, const uint16_t* survivors, size_t count);
+
+  /**
+   * Append gid given the output of encode() for this file's flags.
+   */
+  void add_encoded(uint64_t gid, const uint64_t* data);
+
+  /**
+   * Append the sorted survivors to out as stored in a file with the given
+   * flags: a full bitset, or a compressed container. Lets workers encode
+   * ahead of a single writer.
+   */
+  static void encode(uint32_t flags, size_t n_answers, const uint16_t* survivors,
+                     size_t count, std::vector<uint64_t>& out);
+
+  void finish();
+
+ private:
+  void write(const void* data, size_t bytes);
+
+  void flush();
+
+  std::ostream& os_;
+  PindexHeader header_;
+  std::vector<PindexEntry> table_;
+  // Zeros for slot padding
+  std::vector<char> padding_;
+  std::vector<uint64_t> encoded_;
+  std::vector<char> buffer_;
+  uint64_t offset_;
+};
+
+const size_t PINDEX_WRITE_BUFFER = (size_t) 8 << 20;
+
+PindexWriter::PindexWriter(std::ostream& os, size_t n_guesses, size_t n_answers,
+                           uint64_t fingerprint, uint32_t flags)
+  : os_(os) {
+  memset(&header_, 0, sizeof(header_));
+  memcpy(header_.magic, PINDEX_MAGIC, sizeof(PINDEX_MAGIC));
+  header_.version = PINDEX_VERSION;
+  header_.flags = flags;
+  header_.n_guesses = n_guesses;
+  header_.n_answers = n_answers;
+  header_.fingerprint = fingerprint;
+  header_.stride = flags & PINDEX_COMPRESSED ? 0 : pindex_stride(n_answers);
+
+  padding_.resize(std::max(header_.stride, PINDEX_ALIGN), 0);
+  buffer_.reserve(PINDEX_WRITE_BUFFER);
+  offset_ = sizeof(header_);
+
+  // Placeholder until the table is known
+  write(&header_, sizeof(header_));
+}
+
+void PindexWriter::add(uint64_t gid, const pindex_block* blocks) {
+  assert(!(header_.flags & PINDEX_COMPRESSED));
+
+  const size_t bytes = (header_.n_answers + 63) / 64 * sizeof(uint64_t);
+  write(blocks, bytes);
+  // Zero padding, so it never carries garbage
+  write(padding_.data(), header_.stride - bytes);
+
+  table_.push_back({gid, offset_});
+  offset_ += header_.stride;
+}
+
+void PindexWriter::add_compressed(uint64_t gid, const uint64_t* data, size_t words) {
+  assert(header_.flags & PINDEX_COMPRESSED);
+
+  write(data, words * sizeof(uint64_t));
+
+  table_.push_back({gid, offset_});
+  offset_ += words * sizeof(uint64_t);
+}
+
+void PindexWriter::add_survivors(uint64_t gid, const uint16_t* survivors,
+                                 size_t count) {
+  encoded_.clear();
+  encode(header_.flags, header_.n_answers, survivors, count, encoded_);
+  add_encoded(gid, encoded_.data());
+}
+
+void PindexWriter::add_encoded(uint64_t gid, const uint64_t* data) {
+  if (header_.flags & PINDEX_COMPRESSED) {
+    add_compressed(gid, data, survivor_words(data));
+  } else {
+    add(gid, reinterpret_cast<const pindex_block*>(data));
+  }
+}
+
+void PindexWriter::encode(uint32_t flags, size_t n_answers, const uint16_t* survivors,
+                          size_t count, std::vector<uint64_t>& out) {
+  if (flags & PINDEX_COMPRESSED) {
+    encode_survivors(survivors, count, n_answers, out);
+    return;
+  }
+
+  // Everything but the survivors is pruned
+  const size_t start = out.size();
+  out.resize(start + (n_answers + 63) / 64, ~(uint64_t) 0);
+  if (n_answers % 64) {
+    out.back() = ((uint64_t) 1 << (n_answers % 64)) - 1;
+  }
+  for (size_t k = 0; k < count; ++k) {
+    out[start + survivors[k] / 64] &= ~((uint64_t) 1 << (survivors[k] % 64));
+  }
+}
+
+void PindexWriter::finish() {
+  // Keep the table aligned after variable sized containers
+  const size_t pad = (PINDEX_ALIGN - offset_ % PINDEX_ALIGN) % PINDEX_ALIGN;
+  write(padding_.data(), pad);
+  offset_ += pad;
+
+  // First bitset wins if a duplicated word repeats a gid
+  std::stable_sort(table_.begin(), table_.end(),
+      [](const PindexEntry& a, const PindexEntry& b) {
+        return a.gid < b.gid;
+      });
+  table_.erase(std::unique(table_.begin(), table_.end(),
+      [](const PindexEntry& a, const PindexEntry& b) {
+        return a.gid == b.gid;
+      }), table_.end());
+
+  header_.n_gids = table_.size();
+  header_.table_offset = offset_;
+  write(table_.data(), table_.size() * sizeof(PindexEntry));
+  flush();
+
+  os_.seekp(0);
+  os_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+  os_.seekp(0, std::ios::end);
+  os_.flush();
+}
+
+void PindexWriter::write(const void* data, size_t bytes) {
+  if (buffer_.size() + bytes > PINDEX_WRITE_BUFFER) {
+    flush();
+  }
+  if (bytes >= PINDEX_WRITE_BUFFER) {
+    os_.write(static_cast<const char*>(data), (long) bytes);
+    return;
+  }
+  const char* begin = static_cast<const char*>(data);
+  buffer_.insert(buffer_.end(), begin, begin + bytes);
+}
+
+void PindexWriter::flush() {
+  os_.write(buffer_.data(), (long) buffer_.size());
+  buffer_.clear();
+}
+
+/**
+ * Read-only view of a mapped v2 .pindex.
+ */
+class PindexReader {
+ public:
+  /**
+   * Whether file starts with a v2 header, as opposed to a legacy index.
+   */
+  static bool is_v2(const MappedFile& file) {
+    return file.size() >= sizeof(PindexHeader) &&
+           memcmp(file.data(), PINDEX_MAGIC, sizeof(PINDEX_MAGIC)) == 0;
+  }
+
+  /**
+   * Take over a mapped file, returning false if it isn't a v2 index whose
+   * table lies inside the file. Only the header is read: entries are checked
+   * as find() reaches them, so opening doesn't fault in the whole file.
+   */
+  bool open(MappedFile&& file);
+
+  const PindexHeader& header() const {
+    return *reinterpret_cast<const PindexHeader*>(file_.data());
+  }
+
+  /**
+   * Whether a compressed index is open.
+   */
+  bool compressed() const {
+    return table_ && (header().flags & PINDEX_COMPRESSED);
+  }
+
+  /**
+   * Blocks of the bitset (or words of the survivor container, if compressed)
+   * for gid, or nullptr if the gid isn't in the index or its entry doesn't
+   * point at a whole bitset or container inside the file, in which case
+   * corrupt (if given) is set. Container values aren't checked.
+   */
+  const pindex_block* find(uint64_t gid, bool* corrupt = nullptr) const;
+
+  /**
+   * Whether the table is sorted by gid without repeats, as find() needs to
+   * see every gid. Reads the whole table, unlike open().
+   */
+  bool sorted() const;
+
+ private:
+  MappedFile file_;
+  const PindexEntry* table_ = nullptr;
+  size_t n_gids_ = 0;
+};
+
+bool PindexReader::open(MappedFile&& file) {
+  file_ = std::move(file);
+  table_ = nullptr;
+  n_gids_ = 0;
+
+  if (!is_v2(file_)) {
+    return false;
+  }
+
+  const PindexHeader& h = header();
+  if (h.version != PINDEX_VERSION ||
+      h.stride != (h.flags & PINDEX_COMPRESSED ? 0 : pindex_stride(h.n_answers)) ||
+      h.table_offset % PINDEX_ALIGN != 0 ||
+      h.table_offset > file_.size() ||
+      h.n_gids > (file_.size() - h.table_offset) / sizeof(PindexEntry)) {
+    return false;
+  }
+
+  table_ = reinterpret_cast<const PindexEntry*>(file_.data() + h.table_offset);
+  n_gids_ = h.n_gids;
+  return true;
+}
+
+bool PindexReader::sorted() const {
+  for (size_t k = 1; k < n_gids_; ++k) {
+    if (table_[k].gid <= table_[k - 1].gid) {
+      return false;
+    }
+  }
+  return true;
+}
+
+const pindex_block* PindexReader::find(uint64_t gid, bool* corrupt) const {
+  const PindexEntry* end = table_ + n_gids_;
+  const PindexEntry* it = std::lower_bound(table_, end, gid,
+      [](const PindexEntry& e, uint64_t g) {
+        return e.gid < g;
+      });
+  if (it == end || it->gid != gid) {
+    return nullptr;
+  }
+
+  // Bitsets and containers lie between the header and the table
+  const PindexHeader& h = header();
+  const uint64_t offset = it->offset;
+  bool bad = offset < sizeof(PindexHeader) || offset % sizeof(uint64_t) != 0 ||
+             offset >= h.table_offset;
+  const uint64_t* data = reinterpret_cast<const uint64_t*>(file_.data() + offset);
+  if (!bad) {
+    const uint64_t room = (h.table_offset - offset) / sizeof(uint64_t);
+    if (!(h.flags & PINDEX_COMPRESSED)) {
+      bad = h.stride / sizeof(uint64_t) > room;
+    } else {
+      const uint64_t type = data[0] & 0xFFFFFFFF;
+      bad = type > SURVIVOR_BITMAP ||
+            (type == SURVIVOR_BITMAP && data[0] >> 32 != (h.n_answers + 63) / 64) ||
+            survivor_words(data) > room;
+    }
+  }
+
+  if (bad) {
+    if (corrupt) {
+      *corrupt = true;
+    }
+    return nullptr;
+  }
+  return data;
+}
+
+#endif
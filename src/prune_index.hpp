@@ -2,45 +2,239 @@
 #define PRUNE_INDEX_H
 
 #include "constants.hpp"
+#include "guess.hpp"
 #include "guess_pair.hpp"
 #include "guess_pair_index.hpp"
+#include "lru_cache.hpp"
+#include "mapped_file.hpp"
+#include "pindex_file.hpp"
+#include "survivor_set.hpp"
+#include "thread_pool.hpp"
 
+#include <stdio.h>
+
+#include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <fstream>
+#include <memory>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 const size_t SIZE_UL = sizeof(unsigned long);
 const size_t SIZE_64 = sizeof(uint64_t);
 
+/**
+ * Where PruneIndex keeps its bitsets.
+ */
+enum IndexBackend {
+  // gid -> bitset hash map, built in memory or loaded from a legacy file
+  BACKEND_MAP,
+  // v2 .pindex file, mapped and queried in place
+  BACKEND_MAPPED,
+  // Per guess, answers sorted by pattern code plus bucket offsets
+  BACKEND_CSR,
+  // CSR rows scored and built on first use, kept in a bounded LRU cache
+  BACKEND_LAZY,
+  // gid -> compressed survivor container, in memory or in a mapped file
+  BACKEND_COMPRESSED,
+};
+
+const size_t DEFAULT_ROW_CACHE_BYTES = (size_t) 256 << 20;
+const size_t DEFAULT_BUILD_BYTES = (size_t) 256 << 20;
+const size_t DEFAULT_SIDE_CACHE_BYTES = (size_t) 16 << 20;
+
+/**
+ * Most answers the CSR, lazy and compressed backends can index, or
+ * generate() and update() can write, as they store answer indices in 16 bits.
+ */
+const size_t MAX_PACKED_ANSWERS = UINT16_MAX;
+
+/**
+ * For every guess-pair (guess i, answer j), the set of answers that are
+ * pruned once guess i gets answer j's feedback.
+ *
+ * Guesses and answers may be separate lists: bitsets are over the answers,
+ * rows over the guesses. A single wordlist gives the square index.
+ */
 class PruneIndex {
  public:
-  PruneIndex(const std::vector<std::string>& wordlist)
-    : guess_index_(GuessPairIndex(wordlist)), size_(wordlist.size()) {
+  PruneIndex(const std::vector<std::string>& wordlist,
+             IndexBackend backend = BACKEND_MAP,
+             size_t cache_bytes = DEFAULT_ROW_CACHE_BYTES)
+    : PruneIndex(wordlist, wordlist, backend, cache_bytes) {}
+
+  /**
+   * Build the index in memory, as a gid map or in CSR form, or lazily with
+   * at most about cache_bytes of rows kept at once. A lazy index doesn't
+   * store pattern codes either: rows and codes are scored as needed.
+   *
+   * With more than MAX_PACKED_ANSWERS answers, only the gid map can index
+   * them, so every backend falls back to it.
+   */
+  PruneIndex(const std::vector<std::string>& guesses,
+             const std::vector<std::string>& answers,
+             IndexBackend backend = BACKEND_MAP,
+             size_t cache_bytes = DEFAULT_ROW_CACHE_BYTES)
+    : guess_index_(GuessPairIndex(guesses, answers, backend != BACKEND_LAZY)),
+      n_guesses_(guesses.size()), size_(answers.size()),
+      fingerprint_(wordlist_fingerprint(guesses, answers)) {
+    assert(backend != BACKEND_MAPPED);
+    backend_ = backend;
+    if (backend_ != BACKEND_MAP && size_ > MAX_PACKED_ANSWERS) {
+      std::cerr << size_ << " answers is too many for 16-bit indices, "
+                << "indexing as a gid map" << std::endl;
+      backend_ = BACKEND_MAP;
+      guess_index_.store_codes();
+    }
+    if (backend_ == BACKEND_LAZY) {
+      row_cache_.reset(new LruCache<size_t, CsrRow>(cache_bytes));
+    }
+    map_answers(guesses, answers);
     index();
   }
 
   PruneIndex(const PruneIndex&) = delete;
   PruneIndex(PruneIndex&&) = default;
 
-  PruneIndex(const std::vector<std::string>& wordlist, const std::string& filename)
-    : guess_index_(GuessPairIndex(wordlist)), size_(wordlist.size()) {
-    load_or_generate(filename);
+  PruneIndex(const std::vector<std::string>& wordlist, const std::string& filename,
+             IndexBackend backend = BACKEND_MAP,
+             size_t build_bytes = DEFAULT_BUILD_BYTES)
+    : PruneIndex(wordlist, wordlist, filename, backend, build_bytes) {}
+
+  /**
+   * Map the index in filename. If it's missing or stale, first stream a new
+   * one (as bitsets, or compressed for BACKEND_COMPRESSED) to disk using
+   * about build_bytes of memory, see generate(). Pattern codes are only
+   * stored once the file is mapped. If no file can be written, the index is
+   * built in memory instead, as a gid map past MAX_PACKED_ANSWERS answers.
+   */
+  PruneIndex(const std::vector<std::string>& guesses,
+             const std::vector<std::string>& answers,
+             const std::string& filename,
+             IndexBackend backend = BACKEND_MAP,
+             size_t build_bytes = DEFAULT_BUILD_BYTES)
+    : guess_index_(GuessPairIndex(guesses, answers, false)),
+      n_guesses_(guesses.size()), size_(answers.size()),
+      fingerprint_(wordlist_fingerprint(guesses, answers)) {
+    assert(backend == BACKEND_MAP || backend == BACKEND_COMPRESSED);
+    backend_ = backend;
+    map_answers(guesses, answers);
+    load_or_generate(filename, build_bytes);
+    guess_index_.store_codes();
   }
 
   ~PruneIndex(){}
 
-  // TODO how can we handle out-of-set guesses? build up index on the fly?
   const boost::dynamic_bitset<>* prune(uint64_t gid) const;
-  //const boost::dynamic_bitset<>* prune(const Guess& guess) const; // TODO
   const boost::dynamic_bitset<>* prune(size_t i, size_t j) const;
 
+  /**
+   * Answers pruned by a guess and its feedback, for any guess word, whether
+   * or not it's in the guess list and for any backend.
+   *
+   * Computed on the fly by scoring the word against every answer, and kept
+   * in a bounded side cache keyed by the guess id.
+   */
+  std::shared_ptr<const boost::dynamic_bitset<>> prune(const Guess& guess) const;
+
+  /**
+   * next = pruned | prune(i, j), for any backend.
+   */
+  void apply(size_t i, size_t j, const boost::dynamic_bitset<>& pruned,
+             boost::dynamic_bitset<>& next) const;
+
+  /**
+   * Write a v2 index to a seekable stream, compressed if this index is.
+   */
   void save(std::ostream& os) const;
 
+  /**
+   * Compute and write a v2 index to a seekable stream without holding it in
+   * memory: rows are encoded a chunk at a time on the worker pool while the
+   * previous chunk is written, with chunks sized to fit in about
+   * build_bytes. flags is 0 or PINDEX_COMPRESSED.
+   *
+   * The budget covers both chunks and each worker's scratch row of codes.
+   * Beyond it are the word lists, the writer's buffer and gid table, and the
+   * stored code matrix if any (none when called from the constructor).
+   *
+   * Returns false, writing nothing, if there are more than
+   * MAX_PACKED_ANSWERS answers.
+   */
+  bool generate(std::ostream& os, uint32_t flags, size_t build_bytes) const;
+
+  IndexBackend backend() const {
+    return backend_;
+  }
+
+  /**
+   * Write the index of guesses x answers to filename, reusing the v2 index
+   * in old_filename built from old_guesses x old_answers.
+   *
+   * Rows of guesses in the old list keep their old survivor sets, remapped
+   * to the new answer indices, and only the added answers are scored against
+   * them; only added guesses are scored in full. The output has the old
+   * file's format. Returns false, writing nothing, if the old index is
+   * missing, corrupt or doesn't match the old lists, either list has more than
+   * MAX_PACKED_ANSWERS answers, or the new one can't be written.
+   */
+  static bool update(const std::vector<std::string>& old_guesses,
+                     const std::vector<std::string>& old_answers,
+                     const std::string& old_filename,
+                     const std::vector<std::string>& guesses,
+                     const std::vector<std::string>& answers,
+                     const std::string& filename);
+
+  /**
+   * Pattern code of guess i against answer j.
+   */
+  uint8_t code(size_t i, size_t j) const {
+    return guess_index_.code(i, j);
+  }
+
+  /**
+   * Index in the answer list of guess i, or NO_ANSWER if guess i can't be
+   * the solution.
+   */
+  size_t answer_of(size_t i) const {
+    return answer_of_[i];
+  }
+
+  /**
+   * Index in the guess list of answer j, or NO_GUESS if answer j can't be
+   * guessed and so can never be found.
+   */
+  size_t guess_of(size_t j) const {
+    return guess_of_[j];
+  }
+
+  /**
+   * Whether guesses and answers are the same list, in the same order.
+   */
+  bool square() const {
+    return square_;
+  }
+
+  /**
+   * Number of answers, i.e. the size of each bitset.
+   */
   size_t size() const {
     return size_;
   }
 
+  /**
+   * Number of guesses, i.e. the number of rows.
+   */
+  size_t guesses() const {
+    return n_guesses_;
+  }
+
+  static constexpr size_t NO_ANSWER = SIZE_MAX;
+  static constexpr size_t NO_GUESS = SIZE_MAX;
+
   void _dump() const {
     for (const auto& [gid,v] : prune_index_) {
       std::cout << gid << " " << v << std::endl;
@@ -57,35 +251,183 @@ class PruneIndex {
 
   void load(std::ifstream& file);
 
-  void load_or_generate(const std::string& filename);
+  void load_or_generate(const std::string& filename, size_t build_bytes);
+
+  /**
+   * next = pruned | bits, with bits given as raw blocks.
+   */
+  static void or_blocks(const boost::dynamic_bitset<>& pruned,
+                        const pindex_block* bits,
+                        boost::dynamic_bitset<>& next);
+
+  /**
+   * next = pruned | answers not giving guess i answer j's pattern, scored
+   * from the codes, for pairs whose mapped entry is corrupt.
+   */
+  void apply_scored(size_t i, size_t j, const boost::dynamic_bitset<>& pruned,
+                    boost::dynamic_bitset<>& next) const;
 
   void _index_prune();
 
+  void _index_csr();
+
+  void _index_compressed();
+
+  /**
+   * Survivor container of gid, from memory or the mapped file, or nullptr
+   * if its mapped entry is corrupt.
+   */
+  const uint64_t* container(uint64_t gid) const;
+
+  struct CsrRow {
+    std::vector<uint16_t> order;
+    std::vector<uint16_t> offsets;
+  };
+
+  /**
+   * Sort the answers of guess i by pattern code into order, with the bucket
+   * of code c at [offsets[c], offsets[c + 1]).
+   */
+  void build_csr_row(size_t i, uint16_t* order, uint16_t* offsets) const;
+
+  /**
+   * next = everything pruned but the unpruned answers in order[begin, end).
+   */
+  void apply_bucket(const uint16_t* order, size_t begin, size_t end,
+                    const boost::dynamic_bitset<>& pruned,
+                    boost::dynamic_bitset<>& next) const;
+
+  /**
+   * CSR row of guess i from the cache, building it on a miss.
+   */
+  std::shared_ptr<const CsrRow> lazy_row(size_t i) const;
+
+  void map_answers(const std::vector<std::string>& guesses,
+                   const std::vector<std::string>& answers);
+
   GuessPairIndex guess_index_;
 
   std::unordered_map<std::string, size_t> word_to_i_;
 
+  std::vector<size_t> answer_of_;
+  std::vector<size_t> guess_of_;
+  bool square_ = false;
+
+  IndexBackend backend_ = BACKEND_MAP;
+
   std::unordered_map<uint64_t, boost::dynamic_bitset<>> prune_index_;
 
+  PindexReader mapped_;
+
+  /**
+   * CSR partitions: row i of csr_order_ holds the answers sorted by their
+   * pattern code against guess i, and the answers with code c are
+   *   csr_order_[i * size_ + csr_offsets_[i * CSR_ROW + c],
+   *              i * size_ + csr_offsets_[i * CSR_ROW + c + 1])
+   */
+  static const size_t CSR_ROW = NUM_PATTERNS + 1;
+  std::vector<uint16_t> csr_order_;
+  std::vector<uint16_t> csr_offsets_;
+
+  // Compressed containers back to back, and the word offset of each gid's
+  std::vector<uint64_t> containers_;
+  std::unordered_map<uint64_t, size_t> container_at_;
+
+  // Lazy rows, held by pointer to keep the index movable
+  std::unique_ptr<LruCache<size_t, CsrRow>> row_cache_;
+
+  // Bitsets for guesses by id, see prune(const Guess&)
+  std::unique_ptr<LruCache<uint64_t, boost::dynamic_bitset<>>> side_cache_{
+    new LruCache<uint64_t, boost::dynamic_bitset<>>(DEFAULT_SIDE_CACHE_BYTES)};
+
+  const size_t n_guesses_;
   const size_t size_;
+  const uint64_t fingerprint_;
 };
 
 /**
  * Public
  */
 const boost::dynamic_bitset<>* PruneIndex::prune(uint64_t gid) const {
+  assert(backend_ == BACKEND_MAP);
   assert(prune_index_.count(gid));
   return &prune_index_.at(gid);
 }
 
-// Maybe useful for display?
-//const boost::dynamic_bitset<>* PruneIndex::prune(const Guess& guess) const {
-//  return prune(guess.id_string());
-//}
+std::shared_ptr<const boost::dynamic_bitset<>> PruneIndex::prune(const Guess& guess) const {
+  const uint64_t gid = guess.id_string();
+  std::shared_ptr<const boost::dynamic_bitset<>> cached = side_cache_->get(gid);
+  if (cached) {
+    return cached;
+  }
+
+  // Unpack letters and colours from the id
+  uint8_t letters[5];
+  uint8_t code = 0;
+  for (size_t i = 0; i < 5; ++i) {
+    letters[i] = (uint8_t) ((gid >> 7*i) & 0x1F);
+    code = (uint8_t) (code + ((gid >> (7*i + 5)) & 0b11) * PATTERN_WEIGHTS[i]);
+  }
+
+  std::vector<uint8_t> codes(size_);
+  guess_index_.answer_codes(letters, codes.data());
+
+  // An impossible pattern leaves nothing
+  std::shared_ptr<boost::dynamic_bitset<>> bits =
+    std::make_shared<boost::dynamic_bitset<>>(size_);
+  bits->set();
+  for (size_t j = 0; j < size_; ++j) {
+    if (codes[j] == code) {
+      bits->reset(j);
+    }
+  }
+
+  const size_t cost = sizeof(*bits) + bits->num_blocks() * sizeof(pindex_block);
+  return side_cache_->put(gid, std::move(bits), cost);
+}
 
 const boost::dynamic_bitset<>* PruneIndex::prune(size_t i, size_t j) const {
-  uint64_t gid = guess_index_[i][j];
-  return prune(gid);
+  return prune(guess_index_.gid(i, j));
+}
+
+void PruneIndex::apply(size_t i, size_t j, const boost::dynamic_bitset<>& pruned,
+                       boost::dynamic_bitset<>& next) const {
+  switch (backend_) {
+    case BACKEND_MAP:
+      next = pruned;
+      next |= *prune(i, j);
+      return;
+    case BACKEND_MAPPED: {
+      const pindex_block* bits = mapped_.find(guess_index_.gid(i, j));
+      if (!bits) {
+        apply_scored(i, j, pruned, next);
+        return;
+      }
+      or_blocks(pruned, bits, next);
+      return;
+    }
+    case BACKEND_CSR: {
+      const uint16_t* offsets = &csr_offsets_[i * CSR_ROW + code(i, j)];
+      apply_bucket(&csr_order_[i * size_], offsets[0], offsets[1], pruned, next);
+      return;
+    }
+    case BACKEND_LAZY: {
+      // Holding the row keeps it alive if another thread evicts it
+      std::shared_ptr<const CsrRow> row = lazy_row(i);
+      const uint16_t* offsets = &row->offsets[code(i, j)];
+      apply_bucket(row->order.data(), offsets[0], offsets[1], pruned, next);
+      return;
+    }
+    case BACKEND_COMPRESSED: {
+      const uint64_t* data = container(guess_index_.gid(i, j));
+      if (!data) {
+        apply_scored(i, j, pruned, next);
+        return;
+      }
+      apply_survivors(data, pruned, next);
+      return;
+    }
+  }
 }
 
 /**
@@ -93,61 +435,231 @@ const boost::dynamic_bitset<>* PruneIndex::prune(size_t i, size_t j) const {
  */
 
 void PruneIndex::index() {
-  _index_prune();
+  if (backend_ == BACKEND_CSR) {
+    _index_csr();
+  } else if (backend_ == BACKEND_COMPRESSED) {
+    _index_compressed();
+  } else if (backend_ == BACKEND_MAP) {
+    _index_prune();
+  }
+  // Lazy rows are built on demand
+}
+
+void PruneIndex::map_answers(const std::vector<std::string>& guesses,
+                             const std::vector<std::string>& answers) {
+  square_ = guesses == answers;
+
+  for (size_t j = 0; j < answers.size(); ++j) {
+    // Keep the first of any duplicated answer
+    word_to_i_.insert({answers[j], j});
+  }
+
+  answer_of_.resize(guesses.size());
+  for (size_t i = 0; i < guesses.size(); ++i) {
+    if (square_) {
+      answer_of_[i] = i;
+      continue;
+    }
+    auto it = word_to_i_.find(guesses[i]);
+    answer_of_[i] = it == word_to_i_.end() ? NO_ANSWER : it->second;
+  }
+
+  // First of any duplicated guess, so a duplicated answer maps like the first
+  std::unordered_map<std::string, size_t> guess_to_i;
+  for (size_t i = 0; !square_ && i < guesses.size(); ++i) {
+    guess_to_i.insert({guesses[i], i});
+  }
+  guess_of_.resize(answers.size());
+  for (size_t j = 0; j < answers.size(); ++j) {
+    if (square_) {
+      guess_of_[j] = j;
+      continue;
+    }
+    auto it = guess_to_i.find(answers[j]);
+    guess_of_[j] = it == guess_to_i.end() ? NO_GUESS : it->second;
+  }
 }
 
-// TODO this is slow, save to file
 void PruneIndex::_index_prune() {
-  for (size_t i = 0; i < size_; ++i) {
-    const std::vector<uint64_t>& g_pairs = guess_index_[i];
+  /**
+   * Every gid of a guess row carries the guess's letters, so rows never share
+   * gids (short of duplicate words) and can be built independently: each
+   * worker buckets its row by pattern code, emitting one bitset per pattern
+   * that prunes everything outside the bucket.
+   *
+   * Rows are merged in order afterwards, so the index (and its iteration
+   * order when saved) doesn't depend on the thread count.
+   */
+  std::vector<std::vector<std::pair<uint64_t, boost::dynamic_bitset<>>>> rows(n_guesses_);
+
+  parallel_for(n_guesses_, [&](size_t i) {
+    const uint8_t* g_codes = guess_index_.row(i);
+    std::vector<std::pair<uint64_t, boost::dynamic_bitset<>>>& row = rows[i];
+
+    // Position in row of each pattern's bitset, in order of first appearance
+    int bucket[NUM_PATTERNS];
+    std::fill_n(bucket, NUM_PATTERNS, -1);
 
     for (size_t j = 0; j < size_; ++j) {
-      uint64_t gid = g_pairs[j];
-      // Index all like g guess-pairs as a dynamic bitset
-      if (prune_index_.count(gid)) {
-        // This gid has already been computed
-        continue;
+      const uint8_t code = g_codes[j];
+      if (bucket[code] < 0) {
+        bucket[code] = (int) row.size();
+        row.emplace_back(guess_index_.gid(i, j),
+                         boost::dynamic_bitset<>(size_).set());
       }
+      // Solutions sharing this pattern are not pruned
+      row[(size_t) bucket[code]].second.reset(j);
+    }
+  });
 
-      prune_index_.insert({gid, boost::dynamic_bitset<>(size_, 0)});
-      boost::dynamic_bitset<>* prune = &prune_index_.at(gid);
+  for (auto& row : rows) {
+    for (auto& entry : row) {
+      // First row wins if a duplicated word repeats a gid
+      prune_index_.insert(std::move(entry));
+    }
+    row.clear();
+    row.shrink_to_fit();
+  }
+}
 
-      // Check this gid against all other gids
-      for (size_t k = 0; k < size_; ++k) {
-        uint64_t sid = g_pairs[k];
-        // If g_pairs *don't* match, then they would be pruned.
-        if (gid != sid) {
-          (*prune)[k] = 1;
-        }
-      }
+void PruneIndex::_index_csr() {
+  csr_order_.resize(n_guesses_ * size_);
+  csr_offsets_.resize(n_guesses_ * CSR_ROW);
+
+  parallel_for(n_guesses_, [&](size_t i) {
+    build_csr_row(i, &csr_order_[i * size_], &csr_offsets_[i * CSR_ROW]);
+  }, 16);
+}
+
+void PruneIndex::build_csr_row(size_t i, uint16_t* order, uint16_t* offsets) const {
+  // Answer indices and offsets are stored as 16 bits
+  assert(size_ <= MAX_PACKED_ANSWERS);
+
+  // Per thread, for rows that aren't stored
+  static thread_local std::vector<uint8_t> buffer;
+  buffer.resize(size_);
+
+  // Counting sort by pattern code, stable in answer order
+  const uint8_t* g_codes = guess_index_.row(i, buffer.data());
+
+  size_t counts[NUM_PATTERNS] = {};
+  for (size_t j = 0; j < size_; ++j) {
+    ++counts[g_codes[j]];
+  }
+
+  size_t next[NUM_PATTERNS];
+  size_t offset = 0;
+  for (size_t c = 0; c < NUM_PATTERNS; ++c) {
+    offsets[c] = (uint16_t) offset;
+    next[c] = offset;
+    offset += counts[c];
+  }
+  offsets[NUM_PATTERNS] = (uint16_t) offset;
+
+  for (size_t j = 0; j < size_; ++j) {
+    order[next[g_codes[j]]++] = (uint16_t) j;
+  }
+}
+
+void PruneIndex::apply_bucket(const uint16_t* order, size_t begin, size_t end,
+                              const boost::dynamic_bitset<>& pruned,
+                              boost::dynamic_bitset<>& next) const {
+  next.resize(size_);
+  next.set();
+  for (size_t k = begin; k < end; ++k) {
+    if (!pruned[order[k]]) {
+      next.reset(order[k]);
     }
   }
 }
 
-void PruneIndex::save(std::ostream& os) const {
-  boost::dynamic_bitset<> ulong_mask(size_, ULONG_MAX);
+std::shared_ptr<const PruneIndex::CsrRow> PruneIndex::lazy_row(size_t i) const {
+  std::shared_ptr<const CsrRow> row = row_cache_->get(i);
+  if (row) {
+    return row;
+  }
 
-  // Write size of guess id keyset as fixed size 64-bit uint
-  uint64_t k_size = prune_index_.size();
-  os.write(reinterpret_cast<char *>(&k_size), SIZE_64);
+  std::shared_ptr<CsrRow> built = std::make_shared<CsrRow>();
+  built->order.resize(size_);
+  built->offsets.resize(CSR_ROW);
+  build_csr_row(i, built->order.data(), built->offsets.data());
+
+  const size_t cost = sizeof(CsrRow) + (size_ + CSR_ROW) * sizeof(uint16_t);
+  return row_cache_->put(i, std::move(built), cost);
+}
+
+void PruneIndex::_index_compressed() {
+  /**
+   * As for the bitset map, rows are compressed independently and merged in
+   * order, so the containers' layout doesn't depend on the thread count.
+   */
+  std::vector<std::vector<uint64_t>> row_containers(n_guesses_);
+  std::vector<std::vector<std::pair<uint64_t, size_t>>> row_gids(n_guesses_);
 
-  for (auto [gid, bits] : prune_index_) {
-    // Write 64-bit guess id
-    os.write(reinterpret_cast<const char*>(&gid), SIZE_64);
+  parallel_for(n_guesses_, [&](size_t i) {
+    std::vector<uint16_t> order(size_);
+    uint16_t offsets[CSR_ROW];
+    build_csr_row(i, order.data(), offsets);
 
-    // Write bitset in chunks of size ulong
-    // TODO can technically assemble an in-mem buffer and write all at once,
-    // but only really load needs to be fast once pindex is generated
-    for (size_t i = 0; i < size_; i += 8 * SIZE_UL) {
-      unsigned long ulong = (bits & ulong_mask).to_ulong();
+    for (size_t c = 0; c < NUM_PATTERNS; ++c) {
+      if (offsets[c] == offsets[c + 1]) {
+        continue;
+      }
+      // Any answer in the bucket gives the bucket's gid
+      const uint64_t gid = guess_index_.gid(i, order[offsets[c]]);
 
-      os.write(reinterpret_cast<char*>(&ulong), SIZE_UL);
+      row_gids[i].emplace_back(gid, row_containers[i].size());
+      encode_survivors(&order[offsets[c]], offsets[c + 1] - offsets[c], size_,
+                       row_containers[i]);
+    }
+  }, 16);
 
-      bits >>= (8 * SIZE_UL);
+  for (size_t i = 0; i < n_guesses_; ++i) {
+    const size_t base = containers_.size();
+    containers_.insert(containers_.end(), row_containers[i].begin(),
+                       row_containers[i].end());
+    for (const auto& [gid, offset] : row_gids[i]) {
+      // First row wins if a duplicated word repeats a gid
+      container_at_.insert({gid, base + offset});
     }
+    row_containers[i].clear();
+    row_containers[i].shrink_to_fit();
   }
 }
 
+const uint64_t* PruneIndex::container(uint64_t gid) const {
+  if (mapped_.compressed()) {
+    return mapped_.find(gid);
+  }
+  assert(container_at_.count(gid));
+  return &containers_[container_at_.at(gid)];
+}
+
+void PruneIndex::save(std::ostream& os) const {
+  assert(backend_ == BACKEND_MAP || backend_ == BACKEND_COMPRESSED);
+
+  if (backend_ == BACKEND_COMPRESSED) {
+    PindexWriter writer(os, n_guesses_, size_, fingerprint_, PINDEX_COMPRESSED);
+    for (const auto& [gid, offset] : container_at_) {
+      writer.add_compressed(gid, &containers_[offset],
+                            survivor_words(&containers_[offset]));
+    }
+    writer.finish();
+    return;
+  }
+
+  PindexWriter writer(os, n_guesses_, size_, fingerprint_);
+  std::vector<pindex_block> blocks;
+
+  for (const auto& [gid, bits] : prune_index_) {
+    blocks.resize(bits.num_blocks());
+    boost::to_block_range(bits, blocks.begin());
+    writer.add(gid, blocks.data());
+  }
+
+  writer.finish();
+}
+
 void PruneIndex::load(std::ifstream& file) {
   // Number of unsigned long blocks required to fully hold size_ bits
   const size_t UL_BLOCKS_PER_BITSET = (size_ - 1) / (8 * SIZE_UL) + 1;
@@ -187,17 +699,337 @@ void PruneIndex::load(std::ifstream& file) {
   delete[] bits_buf;
 }
 
-void PruneIndex::load_or_generate(const std::string& filename) {
-  std::ifstream file(filename);
-  if (file.good()) {
-    load(file);
-  } else {
-    file.close();
+void PruneIndex::load_or_generate(const std::string& filename, size_t build_bytes) {
+  MappedFile file;
+  if (file.open(filename)) {
+    if (!PindexReader::is_v2(file)) {
+      // Legacy index: no header to check, read it all into memory
+      std::ifstream legacy(filename);
+      load(legacy);
+      backend_ = BACKEND_MAP;
+      return;
+    }
+
+    if (mapped_.open(std::move(file)) &&
+        mapped_.header().fingerprint == fingerprint_ &&
+        mapped_.header().n_guesses == n_guesses_ &&
+        mapped_.header().n_answers == size_) {
+      backend_ = mapped_.compressed() ? BACKEND_COMPRESSED : BACKEND_MAPPED;
+      return;
+    }
+
+    std::cerr << filename << " is stale or corrupt, regenerating" << std::endl;
+    mapped_ = PindexReader();
+  }
 
-    std::ofstream out(filename);
+  if (size_ > MAX_PACKED_ANSWERS) {
+    std::cerr << size_ << " answers is too many to write " << filename
+              << ", indexing as a gid map" << std::endl;
+    backend_ = BACKEND_MAP;
+    mapped_ = PindexReader();
+    guess_index_.store_codes();
     index();
-    save(out);
+    return;
+  }
+
+  // Write aside and rename, so processes mapping the old file are unaffected
+  const std::string tmp = filename + ".tmp";
+  bool written = false;
+  {
+    std::ofstream out(tmp, std::ios::binary);
+    written = generate(out, backend_ == BACKEND_COMPRESSED ? PINDEX_COMPRESSED : 0,
+                       build_bytes);
+    out.close();
+    written = written && !out.fail();
   }
+  if (!written || rename(tmp.c_str(), filename.c_str()) != 0) {
+    remove(tmp.c_str());
+  } else if (file.open(filename) && mapped_.open(std::move(file)) &&
+             mapped_.header().fingerprint == fingerprint_) {
+    backend_ = mapped_.compressed() ? BACKEND_COMPRESSED : BACKEND_MAPPED;
+    return;
+  }
+
+  std::cerr << "Couldn't write " << filename << ", indexing in memory" << std::endl;
+  mapped_ = PindexReader();
+  guess_index_.store_codes();
+  index();
+}
+
+bool PruneIndex::generate(std::ostream& os, uint32_t flags, size_t build_bytes) const {
+  // Rows are sorted with 16-bit answer indices, as for CSR
+  if (size_ > MAX_PACKED_ANSWERS) {
+    return false;
+  }
+
+  PindexWriter writer(os, n_guesses_, size_, fingerprint_, flags);
+
+  // Most one row can encode to: a bitset per pattern, or one small
+  // container per pattern holding each answer once
+  const size_t buckets = std::min(NUM_PATTERNS, size_);
+  const size_t row_bytes = flags & PINDEX_COMPRESSED ?
+    buckets * 2 * sizeof(uint64_t) + size_ * sizeof(uint16_t) :
+    buckets * (size_ + 63) / 64 * sizeof(uint64_t);
+
+  // Each worker scores and sorts one row at a time
+  const size_t scratch_bytes = thread_count() *
+    (size_ * (sizeof(uint8_t) + sizeof(uint16_t)) + CSR_ROW * sizeof(uint16_t));
+  const size_t chunk_bytes = build_bytes > scratch_bytes ? build_bytes - scratch_bytes : 0;
+
+  // Two chunks are live at once, one encoding while the other is written
+  const size_t chunk = std::max((size_t) 1,
+                                std::min(n_guesses_, chunk_bytes / (2 * row_bytes)));
+
+  struct EncodedRow {
+    std::vector<uint64_t> data;
+    // gid and word offset into data of each bucket
+    std::vector<std::pair<uint64_t, size_t>> gids;
+  };
+  std::vector<EncodedRow> chunks[2] = {
+    std::vector<EncodedRow>(chunk), std::vector<EncodedRow>(chunk),
+  };
+
+  std::thread writing;
+  for (size_t first = 0, c = 0; first < n_guesses_; first += chunk, c ^= 1) {
+    const size_t count = std::min(chunk, n_guesses_ - first);
+    std::vector<EncodedRow>& rows = chunks[c];
+
+    parallel_for(count, [&](size_t r) {
+      const size_t i = first + r;
+      std::vector<uint16_t> order(size_);
+      uint16_t offsets[CSR_ROW];
+      build_csr_row(i, order.data(), offsets);
+
+      EncodedRow& row = rows[r];
+      row.data.clear();
+      row.gids.clear();
+      for (size_t code = 0; code < NUM_PATTERNS; ++code) {
+        if (offsets[code] == offsets[code + 1]) {
+          continue;
+        }
+        // Buckets come out of the counting sort in answer order
+        row.gids.emplace_back(guess_index_.gid(i, order[offsets[code]]), row.data.size());
+        PindexWriter::encode(flags, size_, &order[offsets[code]],
+                             offsets[code + 1] - offsets[code], row.data);
+      }
+    });
+
+    if (writing.joinable()) {
+      writing.join();
+    }
+    writing = std::thread([&writer, &rows, count]() {
+      for (size_t r = 0; r < count; ++r) {
+        for (const auto& [gid, offset] : rows[r].gids) {
+          writer.add_encoded(gid, &rows[r].data[offset]);
+        }
+      }
+    });
+  }
+
+  if (writing.joinable()) {
+    writing.join();
+  }
+  writer.finish();
+  return true;
+}
+
+bool PruneIndex::update(const std::vector<std::string>& old_guesses,
+                        const std::vector<std::string>& old_answers,
+                        const std::string& old_filename,
+                        const std::vector<std::string>& guesses,
+                        const std::vector<std::string>& answers,
+                        const std::string& filename) {
+  // Survivors are remapped and bucketed with 16-bit answer indices
+  if (old_answers.size() > MAX_PACKED_ANSWERS || answers.size() > MAX_PACKED_ANSWERS) {
+    return false;
+  }
+
+  MappedFile file;
+  PindexReader old;
+  if (!file.open(old_filename) || !old.open(std::move(file)) || !old.sorted() ||
+      old.header().fingerprint != wordlist_fingerprint(old_guesses, old_answers)) {
+    return false;
+  }
+
+  const size_t n_old = old_answers.size();
+  const size_t n = answers.size();
+
+  // New index of each old answer, or NO_ANSWER if it was removed
+  std::unordered_map<std::string, size_t> new_index;
+  for (size_t j = 0; j < n; ++j) {
+    new_index.insert({answers[j], j});
+  }
+  std::vector<size_t> remap(n_old, NO_ANSWER);
+  for (size_t oj = 0; oj < n_old; ++oj) {
+    auto it = new_index.find(old_answers[oj]);
+    if (it != new_index.end()) {
+      remap[oj] = it->second;
+    }
+  }
+
+  // Answers that weren't in the old list
+  std::unordered_set<std::string> old_answer_set(old_answers.begin(), old_answers.end());
+  std::vector<size_t> added;
+  for (size_t j = 0; j < n; ++j) {
+    if (!old_answer_set.count(answers[j])) {
+      added.push_back(j);
+    }
+  }
+
+  // Letters of all answers and of the added ones, for the feedback kernel
+  std::vector<uint8_t> all_letters[5];
+  std::vector<uint8_t> added_letters[5];
+  for (size_t pos = 0; pos < 5; ++pos) {
+    for (size_t j = 0; j < n; ++j) {
+      all_letters[pos].push_back((uint8_t) (answers[j][pos] - 'a'));
+    }
+    for (size_t j : added) {
+      added_letters[pos].push_back((uint8_t) (answers[j][pos] - 'a'));
+    }
+  }
+  const uint8_t* all_columns[5];
+  const uint8_t* added_columns[5];
+  for (size_t pos = 0; pos < 5; ++pos) {
+    all_columns[pos] = all_letters[pos].data();
+    added_columns[pos] = added_letters[pos].data();
+  }
+
+  std::unordered_set<std::string> old_guess_set(old_guesses.begin(), old_guesses.end());
+
+  const std::string tmp = filename + ".tmp";
+  std::ofstream out(tmp, std::ios::binary);
+  PindexWriter writer(out, guesses.size(), n, wordlist_fingerprint(guesses, answers),
+                      old.compressed() ? PINDEX_COMPRESSED : 0);
+
+  // Rows are independent: do a chunk at a time on the pool, write in order
+  const size_t CHUNK = 256;
+  std::atomic<bool> corrupt(false);
+  std::vector<std::vector<std::pair<uint64_t, std::vector<uint16_t>>>> rows(CHUNK);
+
+  for (size_t first = 0; first < guesses.size(); first += CHUNK) {
+    const size_t count = std::min(CHUNK, guesses.size() - first);
+
+    parallel_for(count, [&](size_t r) {
+      const Word guess(guesses[first + r]);
+      const uint8_t* g_letters = guess.get_letters();
+      const uint64_t g_id = letters_id(g_letters);
+
+      std::vector<uint16_t> buckets[NUM_PATTERNS];
+      std::vector<uint8_t> codes;
+
+      if (old_guess_set.count(guesses[first + r])) {
+        // Carry over the old buckets, dropping removed answers
+        std::vector<uint16_t> survivors;
+        for (size_t c = 0; c < NUM_PATTERNS; ++c) {
+          bool bad = false;
+          const pindex_block* data = old.find(g_id | pattern_id((uint8_t) c), &bad);
+          if (bad) {
+            corrupt = true;
+          }
+          if (!data) {
+            continue;
+          }
+
+          survivors.clear();
+          if (old.compressed()) {
+            decode_survivors(data, n_old, survivors);
+          } else {
+            for (size_t k = 0; k < (n_old + 63) / 64; ++k) {
+              uint64_t bits = ~data[k];
+              if (k == n_old / 64) {
+                bits &= ((uint64_t) 1 << (n_old % 64)) - 1;
+              }
+              for (; bits; bits &= bits - 1) {
+                survivors.push_back((uint16_t) (k * 64 + (size_t) __builtin_ctzll(bits)));
+              }
+            }
+          }
+
+          for (uint16_t oj : survivors) {
+            if (remap[oj] != NO_ANSWER) {
+              buckets[c].push_back((uint16_t) remap[oj]);
+            }
+          }
+        }
+
+        codes.resize(added.size());
+        feedback_codes(g_letters, added_columns, added.size(), codes.data());
+        for (size_t k = 0; k < added.size(); ++k) {
+          buckets[codes[k]].push_back((uint16_t) added[k]);
+        }
+      } else {
+        codes.resize(n);
+        feedback_codes(g_letters, all_columns, n, codes.data());
+        for (size_t j = 0; j < n; ++j) {
+          buckets[codes[j]].push_back((uint16_t) j);
+        }
+      }
+
+      rows[r].clear();
+      for (size_t c = 0; c < NUM_PATTERNS; ++c) {
+        if (buckets[c].empty()) {
+          continue;
+        }
+        std::sort(buckets[c].begin(), buckets[c].end());
+        rows[r].emplace_back(g_id | pattern_id((uint8_t) c), std::move(buckets[c]));
+      }
+    });
+
+    // A bucket lost to a corrupt entry would drop its answers from the row
+    if (corrupt) {
+      out.close();
+      remove(tmp.c_str());
+      return false;
+    }
+
+    for (size_t r = 0; r < count; ++r) {
+      for (const auto& [gid, survivors] : rows[r]) {
+        writer.add_survivors(gid, survivors.data(), survivors.size());
+      }
+    }
+  }
+
+  writer.finish();
+  out.close();
+
+  // Rename over the old file is fine even if it's the one mapped
+  if (out.fail() || rename(tmp.c_str(), filename.c_str()) != 0) {
+    remove(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+void PruneIndex::apply_scored(size_t i, size_t j, const boost::dynamic_bitset<>& pruned,
+                              boost::dynamic_bitset<>& next) const {
+  static std::atomic<bool> reported(false);
+  if (!reported.exchange(true)) {
+    std::cerr << "Corrupt entry in the mapped index, scoring instead" << std::endl;
+  }
+
+  const uint8_t c = code(i, j);
+  next = pruned;
+  for (size_t k = 0; k < size_; ++k) {
+    if (code(i, k) != c) {
+      next.set(k);
+    }
+  }
+}
+
+void PruneIndex::or_blocks(const boost::dynamic_bitset<>& pruned,
+                           const pindex_block* bits,
+                           boost::dynamic_bitset<>& next) {
+  // Per thread, so concurrent searches don't share it
+  static thread_local std::vector<pindex_block> scratch;
+
+  scratch.resize(pruned.num_blocks());
+  boost::to_block_range(pruned, scratch.begin());
+  for (size_t k = 0; k < scratch.size(); ++k) {
+    scratch[k] |= bits[k];
+  }
+
+  next.resize(pruned.size());
+  boost::from_block_range(scratch.begin(), scratch.end(), next);
 }
 
 #endif
@@ -0,0 +1,257 @@
+#ifndef PRUNE_KERNEL_H
+#define PRUNE_KERNEL_H
+
+#include "constants.hpp"
+#include "simd.hpp"
+
+#include <stdint.h>
+
+const size_t BITS_PER_LETTER = 5;
+const size_t BITS_PER_COUNT = 2;
+const uint64_t LSB_MASK = 0x5555555555555555;
+const uint64_t MSB_MASK = 0xAAAAAAAAAAAAAAAA;
+
+/**
+ * Low four bits and high bit of each 5-bit letter block of an encoded word,
+ * used to test all five blocks for zero at once.
+ */
+const uint32_t BLOCK_LO_MASK = 0x00F7BDEF;
+const uint32_t BLOCK_HI_MASK = 0x01084210;
+
+/**
+ * The checks and masks a guess compiles down to. See Dictionary::prune for
+ * how each one is built.
+ */
+struct PruneMask {
+  uint32_t c_check = 0;
+  uint32_t c_mask = 0;
+  uint32_t w_check = 0;
+  uint32_t w_mask = 0xFFFFFFFF;
+  uint64_t min_cts = 0;
+  uint64_t max_cts = 0;
+  uint64_t max_mask = 0;
+};
+
+/**
+ * Returns the final borrow bit of 2-element-wise x - y.
+ */
+uint64_t borrow_2bit(uint64_t x, uint64_t y) {
+  // Get LSB borrow bit
+  /**
+   * This matches any 0/1 x/y pairs in the first digit.
+   */
+  uint64_t tmp = (~x & y);
+  uint64_t b_in = LSB_MASK & tmp;
+
+  /**
+   * This matches any 0/1 pairs in the second digit:
+   *     (~x & y)
+   *   OR
+   * any matching digits
+   *     ~(x ^ y)
+   *   with a borrow bit from the previous digit:
+   *     (b_in << 1)
+   */
+  return MSB_MASK & (tmp | ((b_in << 1) & ~(x ^ y)));
+}
+
+/**
+ * Whether any of the five 5-bit letter blocks of x is zero.
+ *
+ * Adding 01111 to the low four bits of a block carries into its high bit iff
+ * they are non-zero, and never out of the block, so the high bit of
+ * ((x & LO) + LO) | x is set exactly for the non-zero blocks.
+ */
+bool has_zero_block(uint32_t x) {
+  return ((((x & BLOCK_LO_MASK) + BLOCK_LO_MASK) | x) & BLOCK_HI_MASK)
+    != BLOCK_HI_MASK;
+}
+
+bool should_prune_word(const PruneMask& m,
+                       uint32_t encoded_word, uint64_t letter_cts) {
+  // Check correct placements
+  if ((m.c_check ^ encoded_word) & m.c_mask) {
+    return true;
+  }
+
+  // Check wrong placements
+  if (has_zero_block((m.w_check ^ encoded_word) | m.w_mask)) {
+    return true;
+  }
+
+  // Check min letter count
+  if (borrow_2bit(letter_cts, m.min_cts)) {
+    return true;
+  }
+
+  // Check max letter count
+  return m.max_mask & borrow_2bit(m.max_cts, letter_cts);
+}
+
+/**
+ * Scalar reference kernel, also used for the tail of the vector kernels.
+ */
+void prune_words_scalar(const PruneMask& m,
+                        const uint32_t* words, const uint64_t* counts,
+                        size_t begin, size_t end, uint64_t* pruned) {
+  for (size_t i = begin; i < end; ++i) {
+    if (should_prune_word(m, words[i], counts[i])) {
+      pruned[i / 64] |= (uint64_t) 1 << (i % 64);
+    }
+  }
+}
+
+#ifdef SIMD_X86
+
+__attribute__((target("avx2")))
+__m256i borrow_2bit_avx2(__m256i x, __m256i y) {
+  const __m256i lsb = _mm256_set1_epi64x((long long) LSB_MASK);
+  const __m256i msb = _mm256_set1_epi64x((long long) MSB_MASK);
+
+  __m256i tmp = _mm256_andnot_si256(x, y);
+  __m256i b_in = _mm256_and_si256(lsb, tmp);
+  __m256i same = _mm256_andnot_si256(_mm256_xor_si256(x, y),
+                                     _mm256_slli_epi64(b_in, 1));
+  return _mm256_and_si256(msb, _mm256_or_si256(tmp, same));
+}
+
+/**
+ * 8 words per iteration: one vector of encoded words, two of letter counts.
+ */
+__attribute__((target("avx2")))
+void prune_words_avx2(const PruneMask& m,
+                      const uint32_t* words, const uint64_t* counts,
+                      size_t n, uint64_t* pruned) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i c_check = _mm256_set1_epi32((int) m.c_check);
+  const __m256i c_mask = _mm256_set1_epi32((int) m.c_mask);
+  const __m256i w_check = _mm256_set1_epi32((int) m.w_check);
+  const __m256i w_mask = _mm256_set1_epi32((int) m.w_mask);
+  const __m256i lo = _mm256_set1_epi32((int) BLOCK_LO_MASK);
+  const __m256i hi = _mm256_set1_epi32((int) BLOCK_HI_MASK);
+  const __m256i min_cts = _mm256_set1_epi64x((long long) m.min_cts);
+  const __m256i max_cts = _mm256_set1_epi64x((long long) m.max_cts);
+  const __m256i max_mask = _mm256_set1_epi64x((long long) m.max_mask);
+
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + i));
+
+    __m256i c = _mm256_and_si256(_mm256_xor_si256(w, c_check), c_mask);
+    __m256i x = _mm256_or_si256(_mm256_xor_si256(w, w_check), w_mask);
+    __m256i z = _mm256_and_si256(
+        _mm256_or_si256(_mm256_add_epi32(_mm256_and_si256(x, lo), lo), x), hi);
+    __m256i keep_w = _mm256_and_si256(_mm256_cmpeq_epi32(c, zero),
+                                      _mm256_cmpeq_epi32(z, hi));
+
+    __m256i keep_c[2];
+    for (size_t h = 0; h < 2; ++h) {
+      __m256i ct = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i*>(counts + i + 4 * h));
+      __m256i r = _mm256_or_si256(
+          borrow_2bit_avx2(ct, min_cts),
+          _mm256_and_si256(max_mask, borrow_2bit_avx2(max_cts, ct)));
+      keep_c[h] = _mm256_cmpeq_epi64(r, zero);
+    }
+
+    uint64_t keep =
+      (uint64_t) _mm256_movemask_ps(_mm256_castsi256_ps(keep_w)) &
+      ((uint64_t) _mm256_movemask_pd(_mm256_castsi256_pd(keep_c[0])) |
+       (uint64_t) _mm256_movemask_pd(_mm256_castsi256_pd(keep_c[1])) << 4);
+
+    // 8 | 64, so a group of 8 never straddles two pruned blocks
+    pruned[i / 64] |= (~keep & 0xFF) << (i % 64);
+  }
+
+  prune_words_scalar(m, words, counts, i, n, pruned);
+}
+
+// GCC 12 flags the _mm512_undefined_epi32() passthrough inside several
+// AVX-512 intrinsics as uninitialized
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+__attribute__((target("avx512f")))
+__m512i borrow_2bit_avx512(__m512i x, __m512i y) {
+  const __m512i lsb = _mm512_set1_epi64((long long) LSB_MASK);
+  const __m512i msb = _mm512_set1_epi64((long long) MSB_MASK);
+
+  __m512i tmp = _mm512_andnot_si512(x, y);
+  __m512i b_in = _mm512_and_si512(lsb, tmp);
+  __m512i same = _mm512_andnot_si512(_mm512_xor_si512(x, y),
+                                     _mm512_slli_epi64(b_in, 1));
+  return _mm512_and_si512(msb, _mm512_or_si512(tmp, same));
+}
+
+/**
+ * 16 words per iteration, using mask registers instead of movemask.
+ */
+__attribute__((target("avx512f")))
+void prune_words_avx512(const PruneMask& m,
+                        const uint32_t* words, const uint64_t* counts,
+                        size_t n, uint64_t* pruned) {
+  const __m512i c_check = _mm512_set1_epi32((int) m.c_check);
+  const __m512i c_mask = _mm512_set1_epi32((int) m.c_mask);
+  const __m512i w_check = _mm512_set1_epi32((int) m.w_check);
+  const __m512i w_mask = _mm512_set1_epi32((int) m.w_mask);
+  const __m512i lo = _mm512_set1_epi32((int) BLOCK_LO_MASK);
+  const __m512i hi = _mm512_set1_epi32((int) BLOCK_HI_MASK);
+  const __m512i min_cts = _mm512_set1_epi64((long long) m.min_cts);
+  const __m512i max_cts = _mm512_set1_epi64((long long) m.max_cts);
+  const __m512i max_mask = _mm512_set1_epi64((long long) m.max_mask);
+
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m512i w = _mm512_loadu_si512(words + i);
+
+    __mmask16 c = _mm512_test_epi32_mask(_mm512_xor_si512(w, c_check), c_mask);
+    __m512i x = _mm512_or_si512(_mm512_xor_si512(w, w_check), w_mask);
+    __m512i z = _mm512_and_si512(
+        _mm512_or_si512(_mm512_add_epi32(_mm512_and_si512(x, lo), lo), x), hi);
+    __mmask16 wp = _mm512_cmpneq_epi32_mask(z, hi);
+
+    uint64_t cts_pruned = 0;
+    for (size_t h = 0; h < 2; ++h) {
+      __m512i ct = _mm512_loadu_si512(counts + i + 8 * h);
+      __m512i r = _mm512_or_si512(
+          borrow_2bit_avx512(ct, min_cts),
+          _mm512_and_si512(max_mask, borrow_2bit_avx512(max_cts, ct)));
+      cts_pruned |= (uint64_t) _mm512_test_epi64_mask(r, r) << (8 * h);
+    }
+
+    uint64_t prune = (uint64_t) c | (uint64_t) wp | cts_pruned;
+    pruned[i / 64] |= prune << (i % 64);
+  }
+
+  prune_words_scalar(m, words, counts, i, n, pruned);
+}
+
+#pragma GCC diagnostic pop
+
+#endif
+
+/**
+ * Set bit i of pruned for every word i in [0, n) that fails the constraints of
+ * m. Bits of words that pass are left untouched, so pruned may already hold
+ * an earlier prune.
+ *
+ * words/counts are the encoded words and letter counts of a Dictionary, and
+ * pruned must hold at least (n + 63) / 64 blocks.
+ */
+void prune_words(const PruneMask& m,
+                 const uint32_t* words, const uint64_t* counts,
+                 size_t n, uint64_t* pruned) {
+  switch (simd_level()) {
+#ifdef SIMD_X86
+    case SIMD_AVX512:
+      return prune_words_avx512(m, words, counts, n, pruned);
+    case SIMD_AVX2:
+      return prune_words_avx2(m, words, counts, n, pruned);
+#endif
+    default:
+      return prune_words_scalar(m, words, counts, 0, n, pruned);
+  }
+}
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86
+#include <immintrin.h>
+#endif
+
+enum SimdLevel {
+  SIMD_SCALAR,
+  SIMD_AVX2,
+  SIMD_AVX512,
+};
+
+/**
+ * Widest vector extension supported by the running CPU.
+ *
+ * Kernels are compiled once per level with target attributes rather than
+ * -march flags, so the binary still runs anywhere and callers dispatch on this
+ * at runtime.
+ */
+SimdLevel simd_level() {
+#ifdef SIMD_X86
+  static const SimdLevel level =
+    __builtin_cpu_supports("avx512f") ? SIMD_AVX512 :
+    __builtin_cpu_supports("avx2") ? SIMD_AVX2 :
+    SIMD_SCALAR;
+  return level;
+#else
+  return SIMD_SCALAR;
+#endif
+}
+
+#endif
@@ -3,11 +3,13 @@
 
 #include "constants.hpp"
 #include "dictionary.hpp"
+#include "feedback_table.hpp"
 #include "guess.hpp"
 
 #include <limits.h>
 
 #include <algorithm>
+#include <bitset>
 #include <iostream>
 #include <unordered_map>
 #include <utility>
@@ -20,13 +22,7 @@ const size_t MAX_VALUE = INT_MAX;
 class Solver {
  public:
    Solver(Dictionary* dictionary)
-   : dictionary_(dictionary){}
-
-   ~Solver() {
-     for (auto& [k, v] : computed_guesses_) {
-       delete v;
-     }
-   }
+   : dictionary_(dictionary), feedback_(dictionary->reference_words) {}
 
    /**
     * Determine the optimal guess given an optimally antagonistic game.
@@ -40,24 +36,22 @@ class Solver {
      std::cout << "num prunes: " << num_prunes << std::endl;
      std::cout << "memo_ hits:   " << memo_hits_ << std::endl;
      std::cout << "memo_ misses: " << memo_misses_ << std::endl;
-     std::cout << "guess hits:   " << ghits_ << std::endl;
-     std::cout << "guess misses: " << gmisses_ << std::endl;
      return val;
    }
 
    /**
-    * Determine the antagonistically optimal solution given a guess g which
-    * maximizes the chain length assuming optimal play.
+    * Determine the antagonistically optimal solution given a guess g (as an
+    * index into the dictionary) which maximizes the chain length assuming
+    * optimal play.
     */
-   std::pair<unsigned int, std::string> antagonist(std::string g, unsigned int bound);
+   std::pair<unsigned int, std::string> antagonist(size_t g, unsigned int bound);
 
    const Guess make_guess(std::string g);
 
    void print_remaining(std::ostream& os);
 
  private:
-   std::unordered_map<std::vector<bool>, std::pair<unsigned int, std::string>> memo_;
-   std::unordered_map<std::string, Guess*> computed_guesses_;   // Save computed guesses
+   std::unordered_map<boost::dynamic_bitset<>, std::pair<unsigned int, std::string>> memo_;
 
    static bool compare(std::pair<unsigned int, std::string> a, std::pair<unsigned int, std::string> b) {
      return a.first < b.first;
@@ -65,14 +59,15 @@ class Solver {
 
    Dictionary* const dictionary_;
 
+   // Precomputed guess-solution feedback and the prune mask of each
+   const FeedbackTable feedback_;
+
    size_t depth_ = 0;
 
    size_t num_prunes = 0;
 
    size_t memo_misses_ = 0;
    size_t memo_hits_ = 0;
-   size_t ghits_ = 0;
-   size_t gmisses_ = 0;
 };
 
 /**
@@ -81,11 +76,7 @@ class Solver {
 std::pair<unsigned int, std::string> Solver::player(unsigned int bound) {
   // Fast exit: Only one word to guess, we solve on this guess.
   if (dictionary_->count() == 1) {
-    for (size_t i = 0; i < dictionary_->size(); ++i) {
-      if (!dictionary_->is_pruned(i)) {
-        return std::pair<unsigned int, std::string>(1, dictionary_->reference_words.at(i));
-      }
-    }
+    return std::pair<unsigned int, std::string>(1, dictionary_->reference_words.at(dictionary_->live(0)));
   }
   if (bound == 1) {
     // TODO This is not currently working (sometimes returns different results
@@ -109,15 +100,14 @@ std::pair<unsigned int, std::string> Solver::player(unsigned int bound) {
   std::pair<unsigned int, std::string> best_worst_case(MAX_VALUE, "");
 
   // Pick best word out of unpruned words
-  for (size_t i = 0; i < dictionary_->size(); ++i) {
-    if (dictionary_->is_pruned(i)) {
-      continue;
-    }
+  const size_t live = dictionary_->count();
+  for (size_t k = 0; k < live; ++k) {
+    const size_t i = dictionary_->live(k);
 
     std::string g = dictionary_->reference_words.at(i);
 
     ++depth_;
-    std::pair<unsigned int, std::string> worst_case = antagonist(g, bound);
+    std::pair<unsigned int, std::string> worst_case = antagonist(i, bound);
     --depth_;
 
     if (depth_ == 0) {
@@ -148,43 +138,30 @@ std::pair<unsigned int, std::string> Solver::player(unsigned int bound) {
   return best_worst_case;
 }
 
-std::pair<unsigned int, std::string> Solver::antagonist(std::string g, unsigned int bound) {
+std::pair<unsigned int, std::string> Solver::antagonist(size_t g, unsigned int bound) {
   unsigned int path_sum = 0;   // TODO
   std::pair<unsigned int, std::string> longest_solve(0, "");
 
-  std::vector<bool> computed(dictionary_->reference_words.size(), 0);
-  for (size_t i = 0; i < dictionary_->size(); ++i) {
-    if (dictionary_->is_pruned(i) || computed[i]) {
+  // Use insight that the set this guess reduces to == the set of solutions
+  // that share its feedback code to skip duplicate guess computations
+  std::bitset<NUM_PATTERNS> computed;
+  const size_t live = dictionary_->count();
+  for (size_t k = 0; k < live; ++k) {
+    const size_t i = dictionary_->live(k);
+    const uint8_t code = feedback_.code(g, i);
+    if (computed[code]) {
       continue;
     }
+    computed[code] = 1;
     std::string s = dictionary_->reference_words.at(i);
 
-    if (g == s) {
+    if (g == i) {
       longest_solve = std::max(longest_solve, std::pair<unsigned int, std::string>(1, s), compare);
       ++path_sum;
       continue;
     }
 
-    Guess* guess;
-    std::string gkey = g+s;
-    if (computed_guesses_.count(gkey)) {
-      ++ghits_;
-      guess = computed_guesses_.at(gkey);
-    } else {
-      ++gmisses_;
-      guess = new Guess(g, s);
-      computed_guesses_.insert({gkey, guess});
-    }
-
-    std::vector<bool>* pruned = dictionary_->prune(*guess);
-
-    // Use insight that the set this guess reduces to == the set of guesses
-    // that dedupe with this guess to skip duplicate guess computations
-    for (size_t j = 0; j < pruned->size(); ++j) {
-      if (!pruned->at(j)) {
-        computed[j] = 1;
-      }
-    }
+    dictionary_->prune(feedback_.mask(g, code));
 
     // Player's best solve given this g-s pair
     std::pair<unsigned int, std::string> solve = player(bound - 1);
@@ -200,7 +177,7 @@ std::pair<unsigned int, std::string> Solver::antagonist(std::string g, unsigned
     //if (g == "steed" && depth_ == 1) {
     //  std::cout << "a" << i << std::endl;
 
-    //  std::cout << *guess << " : " << s << std::endl;
+    //  std::cout << dictionary_->reference_words.at(g) << " : " << s << std::endl;
     //  std::cout << "this: " << solve.first << " " << solve.second << std::endl;
     //  std::cout << "best: " << longest_solve.first << " " << longest_solve.second << std::endl;
     //  std::cout << "count: " << dictionary_->count() << std::endl;
@@ -214,7 +191,11 @@ std::pair<unsigned int, std::string> Solver::antagonist(std::string g, unsigned
 }
 
 const Guess Solver::make_guess(std::string g) {
-  auto worst_case = antagonist(g, MAX_VALUE);
+  const std::vector<std::string>& words = dictionary_->reference_words;
+  const size_t g_idx = (size_t) (std::find(words.begin(), words.end(), g) - words.begin());
+  assert(g_idx < words.size());
+
+  auto worst_case = antagonist(g_idx, MAX_VALUE);
   std::cout << worst_case.first << " " << worst_case.second << std::endl;
   Guess guess(g, worst_case.second);
 
@@ -225,10 +206,8 @@ const Guess Solver::make_guess(std::string g) {
 
 void Solver::print_remaining(std::ostream& os) {
   os << "{ ";
-  for (size_t i = 0; i < dictionary_->size(); ++i) {
-    if (!dictionary_->is_pruned(i)) {
-      os << dictionary_->reference_words.at(i) << " ";
-    }
+  for (size_t k = 0; k < dictionary_->count(); ++k) {
+    os << dictionary_->reference_words.at(dictionary_->live(k)) << " ";
   }
   os << "}" << std::endl;
 }
@@ -0,0 +1,231 @@
+#ifndef SURVIVOR_SET_H
+#define SURVIVOR_SET_H
+
+#include "constants.hpp"
+
+#include <assert.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <vector>
+
+/**
+ * Compressed set of surviving answers, the complement of a prune bitset.
+ *
+ * Roaring-style single container (answers are below 2^16), stored as 64-bit
+ * words so the same bytes work in memory and straight out of a mapped file:
+ *
+ *   word 0     type | n << 32
+ *   words 1..  payload, zero padded to a whole word
+ *
+ * with the payload, by type:
+ *   SURVIVOR_ARRAY   n sorted uint16 answer indices
+ *   SURVIVOR_RUN     n (start, length - 1) uint16 pairs
+ *   SURVIVOR_BITMAP  n uint64 words, bit j set iff answer j survives
+ *
+ * uint16 values pack four to a word, the first in the low bits, which is
+ * their byte order in a little endian file.
+ *
+ * Whichever type is smallest for the set is used.
+ */
+enum SurvivorContainer : uint32_t {
+  SURVIVOR_ARRAY,
+  SURVIVOR_RUN,
+  SURVIVOR_BITMAP,
+};
+
+/**
+ * The k-th uint16 value packed in payload.
+ */
+uint16_t survivor_value(const uint64_t* payload, size_t k) {
+  return (uint16_t) (payload[k / 4] >> (16 * (k % 4)));
+}
+
+/**
+ * Set the k-th uint16 value packed in payload to value.
+ */
+void set_survivor_value(uint64_t* payload, size_t k, uint16_t value) {
+  const unsigned shift = (unsigned) (16 * (k % 4));
+  payload[k / 4] = (payload[k / 4] & ~((uint64_t) 0xFFFF << shift)) |
+                   (uint64_t) value << shift;
+}
+
+/**
+ * Append the container for the sorted survivors to out.
+ */
+void encode_survivors(const uint16_t* survivors, size_t count, size_t universe,
+                      std::vector<uint64_t>& out) {
+  size_t runs = 0;
+  for (size_t k = 0; k < count; ++k) {
+    if (k == 0 || survivors[k] != survivors[k - 1] + 1) {
+      ++runs;
+    }
+  }
+
+  const size_t array_words = (count + 3) / 4;
+  const size_t run_words = (runs + 1) / 2;
+  const size_t bitmap_words = (universe + 63) / 64;
+
+  SurvivorContainer type = SURVIVOR_ARRAY;
+  size_t n = count;
+  size_t words = array_words;
+  if (run_words < words) {
+    type = SURVIVOR_RUN;
+    n = runs;
+    words = run_words;
+  }
+  if (bitmap_words < words) {
+    type = SURVIVOR_BITMAP;
+    n = bitmap_words;
+    words = bitmap_words;
+  }
+
+  const size_t start = out.size();
+  out.resize(start + 1 + words, 0);
+  out[start] = type | (uint64_t) n << 32;
+  uint64_t* payload = &out[start + 1];
+
+  if (type == SURVIVOR_BITMAP) {
+    for (size_t k = 0; k < count; ++k) {
+      payload[survivors[k] / 64] |= (uint64_t) 1 << (survivors[k] % 64);
+    }
+    return;
+  }
+
+  if (type == SURVIVOR_ARRAY) {
+    for (size_t k = 0; k < count; ++k) {
+      set_survivor_value(payload, k, survivors[k]);
+    }
+    return;
+  }
+
+  // Lengths start at 0 from the zero padding and count up along each run
+  size_t r = 0;
+  for (size_t k = 0; k < count; ++k) {
+    if (k == 0 || survivors[k] != survivors[k - 1] + 1) {
+      set_survivor_value(payload, 2 * r, survivors[k]);
+      ++r;
+    } else {
+      set_survivor_value(payload, 2 * r - 1,
+                         (uint16_t) (survivor_value(payload, 2 * r - 1) + 1));
+    }
+  }
+}
+
+/**
+ * Words taken by the container starting at data.
+ */
+size_t survivor_words(const uint64_t* data) {
+  const size_t n = (size_t) (data[0] >> 32);
+  switch ((SurvivorContainer) (data[0] & 0xFFFFFFFF)) {
+    case SURVIVOR_ARRAY:
+      return 1 + (n + 3) / 4;
+    case SURVIVOR_RUN:
+      return 1 + (n + 1) / 2;
+    case SURVIVOR_BITMAP:
+      return 1 + n;
+  }
+  assert(false);
+  return 0;
+}
+
+/**
+ * Append the survivors in the container at data to out, in order, dropping
+ * any not below universe, as a corrupt container could hold.
+ */
+void decode_survivors(const uint64_t* data, size_t universe, std::vector<uint16_t>& out) {
+  const size_t n = (size_t) (data[0] >> 32);
+  const uint64_t* payload = data + 1;
+
+  switch ((SurvivorContainer) (data[0] & 0xFFFFFFFF)) {
+    case SURVIVOR_ARRAY:
+      for (size_t k = 0; k < n; ++k) {
+        const uint16_t j = survivor_value(payload, k);
+        if (j < universe) {
+          out.push_back(j);
+        }
+      }
+      return;
+    case SURVIVOR_RUN:
+      for (size_t r = 0; r < n; ++r) {
+        const size_t begin = survivor_value(payload, 2 * r);
+        const size_t end = std::min(universe,
+                                    begin + survivor_value(payload, 2 * r + 1) + 1);
+        for (size_t j = begin; j < end; ++j) {
+          out.push_back((uint16_t) j);
+        }
+      }
+      return;
+    case SURVIVOR_BITMAP:
+      for (size_t k = 0; k < n && k * 64 < universe; ++k) {
+        uint64_t bits = payload[k];
+        if (universe - k * 64 < 64) {
+          bits &= ((uint64_t) 1 << (universe - k * 64)) - 1;
+        }
+        for (; bits; bits &= bits - 1) {
+          out.push_back((uint16_t) (k * 64 + (size_t) __builtin_ctzll(bits)));
+        }
+      }
+      return;
+  }
+}
+
+/**
+ * next = pruned | (everything outside the container at data), without
+ * expanding the container to full width. Survivors past pruned.size(), as a
+ * corrupt container could hold, are ignored.
+ */
+void apply_survivors(const uint64_t* data, const boost::dynamic_bitset<>& pruned,
+                     boost::dynamic_bitset<>& next) {
+  const size_t n = (size_t) (data[0] >> 32);
+  const uint64_t* payload = data + 1;
+
+  if ((data[0] & 0xFFFFFFFF) == SURVIVOR_BITMAP) {
+    // Per thread, so concurrent searches don't share it
+    static thread_local std::vector<boost::dynamic_bitset<>::block_type> scratch;
+    static_assert(sizeof(boost::dynamic_bitset<>::block_type) == sizeof(uint64_t),
+                  "bitmap containers are 64-bit blocks");
+
+    scratch.resize(pruned.num_blocks());
+    boost::to_block_range(pruned, scratch.begin());
+    // Words missing from a short bitmap have no survivors
+    for (size_t k = 0; k < scratch.size(); ++k) {
+      scratch[k] |= k < n ? ~payload[k] : ~(uint64_t) 0;
+    }
+    // Bits past the end must stay clear
+    const size_t tail = pruned.size() % 64;
+    if (tail && !scratch.empty()) {
+      scratch.back() &= ((uint64_t) 1 << tail) - 1;
+    }
+
+    next.resize(pruned.size());
+    boost::from_block_range(scratch.begin(), scratch.end(), next);
+    return;
+  }
+
+  next.resize(pruned.size());
+  next.set();
+
+  if ((data[0] & 0xFFFFFFFF) == SURVIVOR_ARRAY) {
+    for (size_t k = 0; k < n; ++k) {
+      const size_t j = survivor_value(payload, k);
+      if (j < pruned.size() && !pruned[j]) {
+        next.reset(j);
+      }
+    }
+    return;
+  }
+
+  for (size_t r = 0; r < n; ++r) {
+    const size_t begin = survivor_value(payload, 2 * r);
+    const size_t end = std::min(pruned.size(),
+                                begin + survivor_value(payload, 2 * r + 1) + 1);
+    for (size_t j = begin; j < end; ++j) {
+      if (!pruned[j]) {
+        next.reset(j);
+      }
+    }
+  }
+}
+
+#endif
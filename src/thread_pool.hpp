@@ -0,0 +1,59 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/**
+ * Number of worker threads parallel_for runs on. Defaults to the hardware
+ * concurrency, and can be overridden before any work is started.
+ */
+size_t& thread_count() {
+  static size_t threads = std::max(1u, std::thread::hardware_concurrency());
+  return threads;
+}
+
+/**
+ * Run fn(i) for every i in [0, n) across thread_count() workers.
+ *
+ * Workers pull chunks of grain indices off a shared counter, so uneven rows
+ * balance out. Which thread runs which i is not deterministic: fn should
+ * write its result to a slot owned by i and leave any merging to the caller.
+ */
+template <typename F>
+void parallel_for(size_t n, F fn, size_t grain = 1) {
+  const size_t threads = std::min(thread_count(), (n + grain - 1) / grain);
+  if (threads <= 1) {
+    for (size_t i = 0; i < n; ++i) {
+      fn(i);
+    }
+    return;
+  }
+
+  std::atomic<size_t> next(0);
+  auto work = [&]() {
+    for (;;) {
+      const size_t begin = next.fetch_add(grain);
+      if (begin >= n) {
+        return;
+      }
+      const size_t end = std::min(n, begin + grain);
+      for (size_t i = begin; i < end; ++i) {
+        fn(i);
+      }
+    }
+  };
+
+  std::vector<std::thread> pool;
+  for (size_t t = 1; t < threads; ++t) {
+    pool.emplace_back(work);
+  }
+  work();
+  for (std::thread& thread : pool) {
+    thread.join();
+  }
+}
+
+#endif
@@ -0,0 +1,269 @@
+#ifndef TRANSPOSITION_TABLE_H
+#define TRANSPOSITION_TABLE_H
+
+#include "constants.hpp"
+
+#include <assert.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+/**
+ * How a memoized value relates to the true value of its state.
+ */
+enum MemoFlag : uint8_t {
+  MEMO_EXACT,
+  // True value >= stored value
+  MEMO_LOWER,
+  // True value <= stored value
+  MEMO_UPPER,
+};
+
+/**
+ * 128-bit fingerprint of a state, stored in place of the state itself.
+ */
+struct TTKey {
+  uint64_t lo;
+  uint64_t hi;
+
+  bool operator==(const TTKey& other) const {
+    return lo == other.lo && hi == other.hi;
+  }
+};
+
+/**
+ * Two independent 64-bit hashes over the bitset's blocks.
+ */
+TTKey tt_key(const boost::dynamic_bitset<>& bits) {
+  // Per thread, so concurrent searches don't share it
+  static thread_local std::vector<boost::dynamic_bitset<>::block_type> blocks;
+  blocks.resize(bits.num_blocks());
+  boost::to_block_range(bits, blocks.begin());
+
+  uint64_t lo = 0x9E3779B97F4A7C15 ^ bits.size();
+  uint64_t hi = 0xC2B2AE3D27D4EB4F ^ bits.size();
+  for (uint64_t block : blocks) {
+    lo = (lo ^ block) * 0xBF58476D1CE4E5B9;
+    lo ^= lo >> 31;
+    hi = (hi + block) * 0x94D049BB133111EB;
+    hi ^= hi >> 29;
+  }
+
+  // Final avalanche, so nearby states spread over the table
+  lo ^= lo >> 33;
+  lo *= 0xFF51AFD7ED558CCD;
+  lo ^= lo >> 33;
+  hi ^= hi >> 32;
+  hi *= 0xC4CEB9FE1A85EC53;
+  hi ^= hi >> 32;
+
+  // An all-zero key marks an empty slot
+  if (!lo && !hi) {
+    hi = 1;
+  }
+  return {lo, hi};
+}
+
+struct TTEntry {
+  TTKey key;
+  uint32_t g_idx;
+  int32_t value;
+  MemoFlag flag;
+  // Search the entry was stored in, see new_search()
+  uint8_t age;
+  // Ply the state was searched at: shallower states cost more to redo
+  uint16_t depth;
+};
+
+/**
+ * Fixed-size memo for WordleSolver, open addressed by key into buckets of
+ * BUCKET_SIZE entries.
+ *
+ * A full bucket evicts an entry from an older search first, then the
+ * deepest (i.e. cheapest to recompute) entry. Lookups only trust a full
+ * 128-bit key match.
+ *
+ * Safe to share between threads without locks: each slot stores both halves
+ * of its key XORed with both words of its data, so an entry whose data words
+ * come from different writers fails the key check and reads as a miss.
+ */
+class TranspositionTable {
+ public:
+  static const size_t BUCKET_SIZE = 4;
+
+  /**
+   * Table using at most bytes of memory, rounded down to a power of two
+   * number of buckets.
+   */
+  TranspositionTable(size_t bytes);
+
+  TranspositionTable(const TranspositionTable&) = delete;
+
+  /**
+   * Copy the entry stored for key to out, returning false if there is none.
+   */
+  bool probe(const TTKey& key, TTEntry& out) const;
+
+  void store(const TTKey& key, size_t g_idx, int value, MemoFlag flag, int depth);
+
+  /**
+   * Age existing entries, so they're replaced before the new search's.
+   */
+  void new_search() {
+    ++age_;
+  }
+
+  void clear();
+
+  /**
+   * Occupied entries, counted by scanning the table.
+   */
+  size_t size() const;
+
+  size_t capacity() const {
+    return (mask_ + 1) * BUCKET_SIZE;
+  }
+
+ private:
+  /**
+   * An entry as (key.lo ^ d, key.hi ^ d, data[0], data[1]), where
+   * d = data[0] ^ data[1]. All zero when empty, as no key is zero.
+   *
+   * Mixing data[0] from one write with data[1] from another changes d by a
+   * non-zero amount for both key halves, whichever writes the key words came
+   * from, so the decoded key can't match.
+   */
+  struct Slot {
+    std::atomic<uint64_t> words[4];
+  };
+
+  static_assert(sizeof(Slot) == 32, "two slots per cache line");
+
+  struct alignas(64) Bucket {
+    Slot slots[BUCKET_SIZE];
+  };
+
+  Bucket& bucket(const TTKey& key) const {
+    return buckets_[key.lo & mask_];
+  }
+
+  /**
+   * Copy of the entry in slot. A torn entry decodes to the wrong key.
+   */
+  static TTEntry load(const Slot& slot);
+
+  static void save(Slot& slot, const TTEntry& entry);
+
+  static bool empty(const TTEntry& entry) {
+    return !entry.key.lo && !entry.key.hi;
+  }
+
+  std::unique_ptr<Bucket[]> buckets_;
+  size_t mask_ = 0;
+  uint8_t age_ = 0;
+};
+
+TranspositionTable::TranspositionTable(size_t bytes) {
+  size_t n_buckets = 1;
+  while (n_buckets * 2 * sizeof(Bucket) <= bytes) {
+    n_buckets *= 2;
+  }
+  buckets_.reset(new Bucket[n_buckets]);
+  mask_ = n_buckets - 1;
+  clear();
+}
+
+bool TranspositionTable::probe(const TTKey& key, TTEntry& out) const {
+  const Bucket& b = bucket(key);
+  for (const Slot& slot : b.slots) {
+    const TTEntry entry = load(slot);
+    if (entry.key == key) {
+      out = entry;
+      return true;
+    }
+  }
+  return false;
+}
+
+void TranspositionTable::store(const TTKey& key, size_t g_idx, int value,
+                               MemoFlag flag, int depth) {
+  assert(g_idx <= UINT32_MAX);
+  Bucket& b = bucket(key);
+
+  // Slots fill in order and are never freed, so the key can't be stored past
+  // an empty slot
+  Slot* victim = &b.slots[0];
+  TTEntry victim_entry = load(*victim);
+  for (Slot& slot : b.slots) {
+    const TTEntry entry = load(slot);
+    if (empty(entry) || entry.key == key) {
+      victim = &slot;
+      break;
+    }
+
+    // Prefer stale entries, then deeper ones
+    const bool stale = entry.age != age_;
+    const bool victim_stale = victim_entry.age != age_;
+    if (stale != victim_stale ? stale : entry.depth > victim_entry.depth) {
+      victim = &slot;
+      victim_entry = entry;
+    }
+  }
+
+  save(*victim, {key, (uint32_t) g_idx, value, flag, age_,
+                 (uint16_t) std::min(depth, (int) UINT16_MAX)});
+}
+
+void TranspositionTable::clear() {
+  for (size_t i = 0; i <= mask_; ++i) {
+    for (Slot& slot : buckets_[i].slots) {
+      for (std::atomic<uint64_t>& word : slot.words) {
+        word.store(0, std::memory_order_relaxed);
+      }
+    }
+  }
+}
+
+size_t TranspositionTable::size() const {
+  size_t used = 0;
+  for (size_t i = 0; i <= mask_; ++i) {
+    for (const Slot& slot : buckets_[i].slots) {
+      used += !empty(load(slot));
+    }
+  }
+  return used;
+}
+
+TTEntry TranspositionTable::load(const Slot& slot) {
+  uint64_t words[4];
+  for (size_t k = 0; k < 4; ++k) {
+    words[k] = slot.words[k].load(std::memory_order_relaxed);
+  }
+
+  const uint64_t d = words[2] ^ words[3];
+  TTEntry entry;
+  entry.key = {words[0] ^ d, words[1] ^ d};
+  entry.g_idx = (uint32_t) words[2];
+  entry.value = (int32_t) (uint32_t) (words[2] >> 32);
+  entry.flag = (MemoFlag) (words[3] & 0xFF);
+  entry.age = (uint8_t) (words[3] >> 8);
+  entry.depth = (uint16_t) (words[3] >> 16);
+  return entry;
+}
+
+void TranspositionTable::save(Slot& slot, const TTEntry& entry) {
+  const uint64_t data[2] = {
+    entry.g_idx | (uint64_t) (uint32_t) entry.value << 32,
+    entry.flag | (uint64_t) entry.age << 8 | (uint64_t) entry.depth << 16,
+  };
+  const uint64_t d = data[0] ^ data[1];
+  slot.words[0].store(entry.key.lo ^ d, std::memory_order_relaxed);
+  slot.words[1].store(entry.key.hi ^ d, std::memory_order_relaxed);
+  slot.words[2].store(data[0], std::memory_order_relaxed);
+  slot.words[3].store(data[1], std::memory_order_relaxed);
+}
+
+#endif
@@ -3,105 +3,103 @@
 
 #include "constants.hpp"
 
-#include <bitset>
+#include <assert.h>
+#include <stdint.h>
+
 #include <string>
-#include <unordered_map>
-#include <unordered_set>
+#include <type_traits>
 
+/**
+ * Packed representation of a 5 letter word: fixed arrays and bitmasks only,
+ * so words are trivially copyable and can be built at compile time.
+ */
 class Word {
  public:
-  Word(const std::string& word)
-    : word_(word) {
-    encode();
+  constexpr Word(const char* word) {
+    encode(word);
   }
 
-  Word(const Word&) = delete;
-  Word(Word&&) = default;     // required to place in vector
+  Word(const std::string& word)
+    : Word(word.c_str()) {}
 
-  const std::string& get_word() const {
-    return word_;
+  std::string get_word() const {
+    return std::string(word_, NUM_LETTERS);
   }
 
-  const uint8_t* get_letters() const {
+  constexpr const uint8_t* get_letters() const {
     return letters_;
   }
 
-  const uint8_t* get_letter_counts() const {
+  constexpr const uint8_t* get_letter_counts() const {
     return letter_counts_;
   }
 
-  const std::unordered_set<uint8_t>& get_letterset(std::bitset<5> key) const {
-    return lettersets_.at(key);
+  /**
+   * Set of letters (bit l for letter l) in the word.
+   */
+  constexpr uint32_t get_letterset() const {
+    return letterset_;
+  }
+
+  /**
+   * Set of letters at the positions not marked in placed (bit i for
+   * position i), for use in yellow checks.
+   */
+  constexpr uint32_t get_letterset(uint8_t placed) const {
+    uint32_t letterset = 0;
+    for (uint8_t i = 0; i < NUM_LETTERS; ++i) {
+      if (!((placed >> i) & 1)) {
+        letterset |= (uint32_t) 1 << letters_[i];
+      }
+    }
+    return letterset;
   }
 
-  const std::vector<uint8_t>& get_indices_of(uint8_t letter) const {
+  /**
+   * Positions (bit i for position i) at which letter occurs.
+   */
+  constexpr uint8_t get_positions_of(uint8_t letter) const {
     assert(letter < 26);
-    return reverse_letter_index_[letter];
+    return positions_[letter];
   }
 
  private:
-  void encode();
-
-  void populate_lettersets();
+  constexpr void encode(const char* word);
 
-  std::string word_;
+  char word_[NUM_LETTERS] = {};
 
   /*
    * Store letters as a char array for green letter comparisons.
    */
-  uint8_t letters_[5];
+  uint8_t letters_[NUM_LETTERS] = {};
 
   /**
    * Count of each letter, where letter_counts_[letter] is the number of times
    * the letter occurs in letters_.
    */
-  uint8_t letter_counts_[26];
+  uint8_t letter_counts_[26] = {};
 
   /**
-   * For every combination of placed letters, store a set of the remaining
-   * letters for use in yellow checks.
+   * Reverse index where bit i of positions_[letter] is set iff
+   * letters_[i] = letter.
    */
-  std::unordered_map<std::bitset<5>, std::unordered_set<uint8_t>> lettersets_;
+  uint8_t positions_[26] = {};
 
-  /**
-   * Index where reverse_letter_index_[letter] is a vector containing the
-   * index locations i of the letter such that letters[i] = letter, in
-   * ascending order.
-   * Used during guess-pair construction to save time construction a 'placed
-   * tiles' bitset used as a key to lettersets_.
-   */
-  std::vector<std::vector<uint8_t>> reverse_letter_index_;
+  uint32_t letterset_ = 0;
 };
 
-void Word::encode() {
+static_assert(std::is_trivially_copyable<Word>::value,
+              "Word must stay flat to be stored contiguously");
 
-  memset(letter_counts_, 0, 26);
-  reverse_letter_index_.resize(26);
-
-  for (uint8_t i = 0; i < 5; ++i) {
-    uint8_t letter = (uint8_t) (word_[i] - 'a');
+constexpr void Word::encode(const char* word) {
+  for (uint8_t i = 0; i < NUM_LETTERS; ++i) {
+    uint8_t letter = (uint8_t) (word[i] - 'a');
+    assert(letter < 26);
+    word_[i] = word[i];
     letters_[i] = letter;
     ++letter_counts_[letter];
-    assert(letter < 26);
-    reverse_letter_index_[letter].push_back(i);
-  }
-
-  populate_lettersets();
-}
-
-void Word::populate_lettersets() {
-  for (uint8_t i = 0; i < 32; ++i) {
-    std::bitset<5> key(i);
-
-    std::unordered_set<uint8_t> letterset;
-    for (size_t i = 0; i < key.size(); ++i) {
-      bool placed = key[i];
-
-      if (!placed) {
-        letterset.insert(letters_[i]);
-      }
-    }
-    lettersets_.insert({key, letterset});
+    positions_[letter] = (uint8_t) (positions_[letter] | 1 << i);
+    letterset_ |= (uint32_t) 1 << letter;
   }
 }
 
@@ -1,3 +1,4 @@
+#include "decision_tree.hpp"
 #include "dictionary.hpp"
 #include "guess.hpp"
 #include "guess_pair.hpp"
@@ -9,10 +10,12 @@
 #include "mean_wordle.hpp"
 
 #include <assert.h>
+#include <stdio.h>
 
 #include <bitset>
 #include <fstream>
 #include <iostream>
+#include <sstream>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -81,21 +84,207 @@ std::vector<std::string> load_wordlist(std::string filename) {
 //  //return average_sizes;
 //}
 
+/**
+ * Answer games in progress from a tree saved with --save-tree: each line of
+ * stdin is the guesses played so far, as "word colors" pairs (colors as in
+ * Guess::set), and gets back the next guess to play.
+ */
+bool play_tree(const std::string& filename, const std::vector<std::string>& wordlist,
+               const std::vector<std::string>& answers) {
+  DecisionTree tree;
+  if (!tree.open(filename, wordlist_fingerprint(wordlist, answers))) {
+    std::cerr << "Can't open " << filename << " for these word lists" << std::endl;
+    return false;
+  }
+
+  // First occurrence wins, as in the index
+  std::unordered_map<std::string, size_t> g_idx_of;
+  for (size_t g_idx = 0; g_idx < wordlist.size(); ++g_idx) {
+    g_idx_of.emplace(wordlist[g_idx], g_idx);
+  }
+
+  std::string line;
+  while (std::getline(std::cin, line)) {
+    std::istringstream turns(line);
+    std::vector<std::pair<size_t, uint8_t>> history;
+    std::string word;
+    std::string colors;
+    bool valid = true;
+    while (valid && turns >> word) {
+      auto found = g_idx_of.find(word);
+      uint8_t code = 0;
+      valid = found != g_idx_of.end() && turns >> colors && parse_feedback(colors, code);
+      history.emplace_back(valid ? found->second : 0, code);
+    }
+
+    const std::pair<size_t, int> next = valid ?
+      tree.next_guess(history) :
+      std::pair<size_t, int>(DecisionTree::NO_GUESS, 0);
+    if (next.first == DecisionTree::NO_GUESS) {
+      std::cout << "No guess" << std::endl;
+    } else {
+      std::cout << wordlist[next.first] << ": " << next.second << std::endl;
+    }
+  }
+  return true;
+}
+
 int main(int argc, char** argv) {
-  if (argc != 2 && argc != 3) {
-    std::cerr << "USAGE: ./wordle_bits wordlist [prune_index]" << std::endl;
+  std::vector<std::string> args(argv + 1, argv + argc);
+
+  // Options for solving directly, rather than playing mean wordle
+  bool solve = false;
+  std::string answers_file;   // solve for these, guessing from wordlist
+  IndexBackend backend = BACKEND_MAP;
+  size_t cache_bytes = DEFAULT_ROW_CACHE_BYTES;
+  size_t build_bytes = DEFAULT_BUILD_BYTES;
+  size_t tt_bytes = DEFAULT_TT_BYTES;
+  // Find the fewest guesses by iterative deepening, or only check within
+  bool deepen = false;
+  int within = 0;
+  // Decision tree to write after solving, or to answer from without solving
+  std::string save_tree_file;
+  std::string play_tree_file;
+  // Old lists and index to update prune_index from, rather than rebuild
+  std::string old_wordlist_file;
+  std::string old_answers_file;
+  std::string old_pindex_file;
+
+  while (!args.empty() && args[0].rfind("--", 0) == 0) {
+    if (args[0] == "--answers" && args.size() >= 2) {
+      answers_file = args[1];
+      args.erase(args.begin());
+    } else if (args[0] == "--csr") {
+      backend = BACKEND_CSR;
+    } else if (args[0] == "--compressed") {
+      backend = BACKEND_COMPRESSED;
+    } else if (args[0] == "--lazy") {
+      backend = BACKEND_LAZY;
+    } else if (args[0] == "--update-from" && args.size() >= 3) {
+      old_wordlist_file = args[1];
+      old_pindex_file = args[2];
+      args.erase(args.begin(), args.begin() + 2);
+    } else if (args[0] == "--old-answers" && args.size() >= 2) {
+      old_answers_file = args[1];
+      args.erase(args.begin());
+    } else if (args[0] == "--build-mb" && args.size() >= 2) {
+      build_bytes = std::stoul(args[1]) << 20;
+      args.erase(args.begin());
+    } else if (args[0] == "--cache-mb" && args.size() >= 2) {
+      cache_bytes = std::stoul(args[1]) << 20;
+      args.erase(args.begin());
+    } else if (args[0] == "--tt-mb" && args.size() >= 2) {
+      tt_bytes = std::stoul(args[1]) << 20;
+      args.erase(args.begin());
+    } else if (args[0] == "--deepen") {
+      deepen = true;
+    } else if (args[0] == "--within" && args.size() >= 2) {
+      within = std::stoi(args[1]);
+      args.erase(args.begin());
+    } else if (args[0] == "--save-tree" && args.size() >= 2) {
+      save_tree_file = args[1];
+      args.erase(args.begin());
+    } else if (args[0] == "--play-tree" && args.size() >= 2) {
+      play_tree_file = args[1];
+      args.erase(args.begin());
+    } else if (args[0] == "--threads" && args.size() >= 2) {
+      thread_count() = std::max((size_t) 1, (size_t) std::stoul(args[1]));
+      args.erase(args.begin());
+    } else {
+      args.clear();
+      break;
+    }
+    solve = true;
+    args.erase(args.begin());
+  }
+
+  if (args.size() != 1 && args.size() != 2) {
+    std::cerr << "USAGE: ./wordle_bits [--answers answer_list] [--csr | --lazy | --compressed] "
+              << "[--cache-mb N] [--build-mb N] [--tt-mb N] [--threads N] [--deepen | --within K] "
+              << "[--save-tree tree_file | --play-tree tree_file] [--update-from old_wordlist old_prune_index "
+              << "[--old-answers old_answer_list]] wordlist [prune_index]"
+              << std::endl;
     return 1;
   }
 
-  std::vector<std::string> wordlist = load_wordlist(argv[1]);
+  std::vector<std::string> wordlist = load_wordlist(args[0]);
+
+  if (solve) {
+    std::vector<std::string> answers = answers_file.empty() ?
+      wordlist : load_wordlist(answers_file);
+
+    if (!play_tree_file.empty()) {
+      return play_tree(play_tree_file, wordlist, answers) ? 0 : 1;
+    }
+
+    // An answer that isn't a guess can never be found
+    const std::unordered_set<std::string> guessable(wordlist.begin(), wordlist.end());
+    for (const std::string& answer : answers) {
+      if (!guessable.count(answer)) {
+        std::cerr << answer << " is an answer but not in " << args[0]
+                  << ", so can't be solved for" << std::endl;
+        return 1;
+      }
+    }
+
+    if (!old_pindex_file.empty() && args.size() == 2) {
+      std::vector<std::string> old_wordlist = load_wordlist(old_wordlist_file);
+      std::vector<std::string> old_answers = old_answers_file.empty() ?
+        old_wordlist : load_wordlist(old_answers_file);
+
+      if (!PruneIndex::update(old_wordlist, old_answers, old_pindex_file,
+                              wordlist, answers, args[1])) {
+        std::cerr << "Can't update from " << old_pindex_file
+                  << ", building from scratch" << std::endl;
+      }
+    }
+
+    // CSR and lazy partitions are always built in memory
+    const bool saved = backend == BACKEND_MAP || backend == BACKEND_COMPRESSED;
+    PruneIndex pindex = args.size() == 2 && saved ?
+      PruneIndex(wordlist, answers, args[1], backend, build_bytes) :
+      PruneIndex(wordlist, answers, backend, cache_bytes);
+
+    WordleSolver solver(std::move(pindex), tt_bytes);
+    if (within > 0) {
+      std::pair<size_t, bool> start =
+        solver.solvable(boost::dynamic_bitset<>(answers.size()), within);
+      std::cout << "Solvable in " << within << ": "
+                << (start.second ? "yes, starting with " + wordlist[start.first] : "no")
+                << std::endl;
+      return 0;
+    }
+    std::pair<size_t, int> best = deepen ? solver.solve_by_deepening() : solver.solve();
+    std::cout << wordlist[best.first] << ": " << best.second << std::endl;
+
+    if (!save_tree_file.empty()) {
+      // Write aside and rename, so a failed build leaves no partial tree
+      const std::string tmp = save_tree_file + ".tmp";
+      bool built = false;
+      bool written = false;
+      {
+        std::ofstream os(tmp, std::ios::binary);
+        built = DecisionTree::build(solver, os, wordlist_fingerprint(wordlist, answers));
+        os.close();
+        written = !os.fail();
+      }
+      if (!built || !written || rename(tmp.c_str(), save_tree_file.c_str()) != 0) {
+        remove(tmp.c_str());
+        std::cerr << (built ? "Can't write " : "No optimal play to save in ")
+                  << save_tree_file << std::endl;
+        return 1;
+      }
+    }
+    return 0;
+  }
 
   //std::cout << "Initializing prune index..." << std::endl;
   //PruneIndex tmp = argc == 3 ?
   //  PruneIndex(wordlist, argv[2]) :
   //  PruneIndex(wordlist);
 
-  MeanWordle sol_only = argc == 3 ? MeanWordle(wordlist, argv[2]) :
-                                    MeanWordle(wordlist);
+  MeanWordle sol_only = args.size() == 2 ? MeanWordle(wordlist, args[1]) :
+                                           MeanWordle(wordlist);
   sol_only.play();
 
   //std::cout << "Solving" << std::endl;
@@ -3,34 +3,127 @@
 
 #include "constants.hpp"
 #include "guess_pair.hpp"
+#include "partition_set.hpp"
 #include "prune_index.hpp"
+#include "thread_pool.hpp"
+#include "transposition_table.hpp"
 
+#include <limits.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
 #include <string>
 #include <vector>
 #include <unordered_map>
 #include <unordered_set>
 
+/**
+ * Value bound meaning "no bound", and the value of a state that can't be
+ * solved. Small enough that a few +1s don't overflow.
+ */
+const int UNBOUNDED = INT_MAX / 2;
+
+const size_t DEFAULT_TT_BYTES = (size_t) 64 << 20;
+
+/**
+ * Fewest answers for which guesses are scored and sorted before searching.
+ * Below it the search is cheaper than the scoring.
+ */
+const size_t ORDER_MIN_SURVIVORS = 64;
+
+/**
+ * Most answers for which a guess is checked for a coarser partition than
+ * every guess tried before it, rather than just an equal one.
+ */
+const size_t DOMINANCE_MAX_SURVIVORS = 32;
+
+/**
+ * Fewest guesses that can find every one of n answers.
+ *
+ * A guess leaves at most 242 patterns besides the all green one, so k guesses
+ * tell apart at most f(k) = 1 + 242 * f(k - 1) answers, with f(1) = 1.
+ */
+int min_guesses(size_t n) {
+  int k = 1;
+  for (size_t f = 1; f < n; f = 1 + (NUM_PATTERNS - 1) * f) {
+    ++k;
+  }
+  return n ? k : 0;
+}
+
+/**
+ * Index of the first answer not in pruned, or pruned.size() if there's none.
+ */
+size_t first_survivor(const boost::dynamic_bitset<>& pruned) {
+  // Per thread, so concurrent searches don't share it
+  static thread_local std::vector<boost::dynamic_bitset<>::block_type> blocks;
+  blocks.resize(pruned.num_blocks());
+  boost::to_block_range(pruned, blocks.begin());
+
+  for (size_t k = 0; k < blocks.size(); ++k) {
+    if (~blocks[k]) {
+      const size_t s_idx = k * 64 + (size_t) __builtin_ctzll(~blocks[k]);
+      return std::min(s_idx, pruned.size());
+    }
+  }
+  return pruned.size();
+}
 
 class WordleSolver {
  public:
-  WordleSolver(std::vector<std::string> wordlist)
-    : size_(wordlist.size()), pindex_(PruneIndex(wordlist)) {}
+  WordleSolver(std::vector<std::string> wordlist,
+               size_t tt_bytes = DEFAULT_TT_BYTES)
+    : size_(wordlist.size()), pindex_(PruneIndex(wordlist)), tt_(tt_bytes) {}
+
+  /**
+   * Solve for the answers, allowed to guess any word in guesses.
+   */
+  WordleSolver(const std::vector<std::string>& guesses,
+               const std::vector<std::string>& answers,
+               size_t tt_bytes = DEFAULT_TT_BYTES)
+    : size_(answers.size()), pindex_(PruneIndex(guesses, answers)), tt_(tt_bytes) {}
 
-  WordleSolver(PruneIndex&& pindex)
-    : size_(pindex.size()), pindex_(std::move(pindex)) {}
+  /**
+   * tt_bytes bounds the memory used to memoize states.
+   */
+  WordleSolver(PruneIndex&& pindex, size_t tt_bytes = DEFAULT_TT_BYTES)
+    : size_(pindex.size()), pindex_(std::move(pindex)), tt_(tt_bytes) {}
 
   /**
    * Player picks the best guess that minimizes his path.
    * Antagonist picks the solution for the given guess that maximizes the path.
-   * Both return a pair<idx, path_length> where word[idx] is the word.
+   * Both return a pair<idx, path_length>, where idx is into the guesses for
+   * player and into the answers for antagonist.
+   *
+   * Player tries the memoized guess for the state, if any, then the rest in
+   * order_guesses() order, and keeps the first of equally good ones.
+   * Antagonist tries the smallest pattern buckets first.
+   *
+   * Given the partitions player has tried at this state, antagonist returns
+   * beta rather than search a guess splitting the answers the same as (or,
+   * with at most DOMINANCE_MAX_SURVIVORS answers, coarser than) one already
+   * tried.
+   *
+   * Searches are alpha-beta, fail-soft, within the window (alpha, beta): a
+   * path_length strictly inside it is exact, one <= alpha is an upper bound
+   * on the true value and one >= beta a lower bound. The default window
+   * always gives the exact value.
+   *
+   * An answer that isn't in the guess list can't be found, so a state with
+   * only it left is worth UNBOUNDED, as is any state it can be left in.
    */
-  std::pair<size_t, int> player(const boost::dynamic_bitset<>& pruned, int depth);
-  std::pair<size_t, int> antagonist(boost::dynamic_bitset<> pruned,
-                                    size_t g_idx, int depth);
+  std::pair<size_t, int> player(const boost::dynamic_bitset<>& pruned, int depth,
+                                int alpha = 0, int beta = UNBOUNDED);
+  std::pair<size_t, int> antagonist(const boost::dynamic_bitset<>& pruned,
+                                    size_t g_idx, int depth,
+                                    int alpha = 0, int beta = UNBOUNDED,
+                                    PartitionSet* tried = nullptr);
   std::pair<size_t, int> solve(boost::dynamic_bitset<> pruned) {
     assert(pruned.size() == size_);
-    auto ans = player(pruned, 0);
-    std::cout << "Memo size: " << memo_.size() << std::endl;
+    tt_.new_search();
+    auto ans = root(pruned);
+    std::cout << "Memo size: " << tt_.size() << std::endl;
     return ans;
   }
 
@@ -38,87 +131,372 @@ class WordleSolver {
     return solve(boost::dynamic_bitset<>(size_));
   }
 
+  /**
+   * Whether the unpruned answers can all be found within k guesses, and if so
+   * the guess to start with.
+   *
+   * A null window search around k: fails as soon as any reply is shown to
+   * need more, without working out how many.
+   */
+  std::pair<size_t, bool> solvable(const boost::dynamic_bitset<>& pruned, int k) {
+    assert(pruned.size() == size_);
+    auto ans = root(pruned, k, k + 1);
+    return std::pair<size_t, bool>(ans.first, ans.second <= k);
+  }
+
+  /**
+   * Same result as solve(), found by asking solvable() for k = 1, 2, ...
+   * Each failed k leaves bounds in the memo that speed up the next.
+   *
+   * No k works if an answer can't be guessed, so that gives
+   * (NO_GUESS, UNBOUNDED) straight away.
+   */
+  std::pair<size_t, int> solve_by_deepening(boost::dynamic_bitset<> pruned) {
+    assert(pruned.size() == size_);
+    for (size_t s_idx = 0; s_idx < size_; ++s_idx) {
+      if (!pruned[s_idx] && pindex_.guess_of(s_idx) == PruneIndex::NO_GUESS) {
+        return std::pair<size_t, int>(PruneIndex::NO_GUESS, UNBOUNDED);
+      }
+    }
+
+    tt_.new_search();
+    for (int k = min_guesses(size_ - pruned.count()); ; ++k) {
+      auto ans = solvable(pruned, k);
+      std::cout << "Solvable in " << k << ": " << (ans.second ? "yes" : "no") << std::endl;
+      if (ans.second) {
+        std::cout << "Memo size: " << tt_.size() << std::endl;
+        return std::pair<size_t, int>(ans.first, k);
+      }
+    }
+  }
+
+  std::pair<size_t, int> solve_by_deepening() {
+    return solve_by_deepening(boost::dynamic_bitset<>(size_));
+  }
+
   std::pair<size_t, boost::dynamic_bitset<>> make_guess(boost::dynamic_bitset<> pruned, size_t g_idx);
 
+  const PruneIndex& pindex() const {
+    return pindex_;
+  }
+
  private:
+  /**
+   * The guesses worth considering for the unpruned answers, most promising
+   * first.
+   *
+   * A square index only guesses the remaining answers. With a separate guess
+   * list any guess may be played, but one that isn't an answer has to split
+   * the remaining answers or it makes no progress.
+   *
+   * With at least ORDER_MIN_SURVIVORS answers, guesses are ranked by how they
+   * partition them: smallest largest pattern bucket, then most buckets, then
+   * g_idx. Good guesses found early tighten the bound the rest are searched
+   * against. Otherwise they're in g_idx order.
+   */
+  std::vector<size_t> order_guesses(const boost::dynamic_bitset<>& pruned) const;
+
+  /**
+   * player() at depth 0, with the guesses spread over thread_count() threads
+   * sharing tt_.
+   *
+   * The best (value, rank) so far is shared, so each guess is only searched
+   * as far as it takes to tell it can't beat it. Ties go to the guess first
+   * in order_guesses(), so the result doesn't depend on the thread count.
+   */
+  std::pair<size_t, int> root(const boost::dynamic_bitset<>& pruned,
+                              int alpha = 0, int beta = UNBOUNDED);
+
    static bool cmp(std::pair<size_t, int> a, std::pair<size_t, int> b) {
      return a.second < b.second;
    }
 
-  std::unordered_map<boost::dynamic_bitset<>, std::pair<int, size_t>> memo_;
-
   size_t size_;
   const PruneIndex pindex_;
+
+  // Memo of searched states, by fingerprint
+  TranspositionTable tt_;
 };
 
-std::pair<size_t, int> WordleSolver::player(const boost::dynamic_bitset<>& pruned, int depth) {
-  if (memo_.count(pruned)) {
-    return memo_.at(pruned);
+std::pair<size_t, int> WordleSolver::player(const boost::dynamic_bitset<>& pruned, int depth,
+                                            int alpha, int beta) {
+  const size_t survivors = size_ - pruned.count();
+  if (survivors == 1) {
+    // There's only one solution, we always guess it, unless it isn't a guess
+    const size_t g_idx = pindex_.guess_of(first_survivor(pruned));
+    if (g_idx == PruneIndex::NO_GUESS) {
+      return std::pair<size_t, int>(g_idx, UNBOUNDED);
+    }
+    return std::pair<size_t, int>(g_idx, 1);
   }
 
-  if (pruned.count() == 1) {
-    // There's only one solution, we always guess it.
-    return std::pair<size_t, int>(0, 1);
+  const TTKey key = tt_key(pruned);
+  TTEntry entry;
+  const bool hit = tt_.probe(key, entry);
+  if (hit) {
+    if (entry.flag == MEMO_EXACT ||
+        (entry.flag == MEMO_LOWER && entry.value >= beta) ||
+        (entry.flag == MEMO_UPPER && entry.value <= alpha)) {
+      return std::pair<size_t, int>(entry.g_idx, entry.value);
+    }
+    // Otherwise the stored bound still narrows the window
+    if (entry.flag == MEMO_LOWER) {
+      alpha = std::max(alpha, entry.value);
+    } else {
+      beta = std::min(beta, entry.value);
+    }
   }
 
-  // TODO base cases where all pruned or only one
-
-  std::pair<size_t, int> best_guess(0, INT_MAX);
+  const int lower_bound = min_guesses(survivors);
+  if (lower_bound >= beta) {
+    return std::pair<size_t, int>(0, lower_bound);
+  }
 
-  for (size_t g_idx = 0; g_idx < size_; ++g_idx) {
-    if (pruned[g_idx]) {
-      continue;
-    }
-    if (depth == 0) {
-      //std::cout << g_idx << ": " << wordlist_[g_idx] << std::endl;
-    }
+  const int alpha_in = alpha;
+  std::pair<size_t, int> best_guess(0, UNBOUNDED);
 
-    std::pair<size_t, int> guess(g_idx, antagonist(pruned, g_idx, depth).second);
+  std::vector<size_t> order = order_guesses(pruned);
+  if (hit) {
+    // The guess that last decided this state likely still does
+    auto it = std::find(order.begin(), order.end(), (size_t) entry.g_idx);
+    std::rotate(order.begin(), it, it == order.end() ? it : it + 1);
+  }
+  PartitionSet tried(pindex_, pruned, DOMINANCE_MAX_SURVIVORS);
+  for (size_t g_idx : order) {
+    // Only need to know if this guess beats the best so far
+    std::pair<size_t, int> guess(g_idx, antagonist(pruned, g_idx, depth, alpha,
+                                                   std::min(beta, best_guess.second),
+                                                   &tried).second);
 
     best_guess = std::min(best_guess, guess, cmp);
+
+    if (best_guess.second <= alpha || best_guess.second <= lower_bound) {
+      // The antagonist won't let us get here, or we can't do better
+      break;
+    }
   }
 
-  memo_.insert({pruned, best_guess});
+  MemoFlag flag = MEMO_EXACT;
+  if (best_guess.second <= alpha_in) {
+    flag = MEMO_UPPER;
+  } else if (best_guess.second >= beta) {
+    flag = MEMO_LOWER;
+  }
+  tt_.store(key, best_guess.first, best_guess.second, flag, depth);
 
   return best_guess;
 }
 
-std::pair<size_t, int> WordleSolver::antagonist(boost::dynamic_bitset<> pruned,
-                                                size_t g_idx, int depth) {
+std::pair<size_t, int> WordleSolver::antagonist(const boost::dynamic_bitset<>& pruned,
+                                                size_t g_idx, int depth,
+                                                int alpha, int beta,
+                                                PartitionSet* tried) {
   std::pair<size_t, int> worst_solution(0, 0);
-  boost::dynamic_bitset<> computed(size_);
+  const size_t g_answer = pindex_.answer_of(g_idx);
+  boost::dynamic_bitset<> next_pruned;
+
+  // Solutions with the same pattern leave the same answers: try one of each.
+  // Small buckets are cheap to search and raise the floor, so the big ones
+  // after them are searched in a narrower window
+  struct Bucket {
+    size_t count;
+    size_t s_idx;
+  };
+  std::vector<Bucket> buckets;
+  int bucket_of[NUM_PATTERNS];
+  std::fill(bucket_of, bucket_of + NUM_PATTERNS, -1);
 
   for (size_t s_idx = 0; s_idx < size_; ++s_idx) {
-    if (pruned[s_idx] || computed[s_idx]) {
-      assert(s_idx != g_idx);
+    if (pruned[s_idx]) {
       continue;
     }
+    const uint8_t code = pindex_.code(g_idx, s_idx);
+    if (bucket_of[code] < 0) {
+      bucket_of[code] = (int) buckets.size();
+      buckets.push_back({0, s_idx});
+    }
+    assert(s_idx != g_answer || buckets[(size_t) bucket_of[code]].s_idx == s_idx);
+    ++buckets[(size_t) bucket_of[code]].count;
+  }
+  std::stable_sort(buckets.begin(), buckets.end(),
+      [](const Bucket& a, const Bucket& b) {
+        return a.count < b.count;
+      });
 
-    if (g_idx == s_idx) {
+  if (!buckets.empty() && buckets.back().count > 1) {
+    // Fail fast if the largest bucket alone needs too many more guesses
+    const int largest = 1 + min_guesses(buckets.back().count);
+    if (largest >= beta) {
+      return std::pair<size_t, int>(buckets.back().s_idx, largest);
+    }
+  }
+
+  // Only checked for guesses that got this far, as it costs as much as the
+  // check above. No better than a guess already tried, which either set the
+  // player's best (and so beta) or was shown to be at least beta.
+  if (tried && !tried->insert(g_idx)) {
+    return std::pair<size_t, int>(0, beta);
+  }
+
+  for (const Bucket& bucket : buckets) {
+    const size_t s_idx = bucket.s_idx;
+    if (g_answer == s_idx) {
       // Player guessed the right word
       worst_solution = std::max(worst_solution, std::pair<size_t, int>(s_idx, 1), cmp);
       continue;
     }
 
-    // TODO computed guesses
-    const boost::dynamic_bitset<>* gs_pruned = pindex_.prune(g_idx, s_idx);
-    computed |= ~*gs_pruned;
-    boost::dynamic_bitset<> next_pruned = pruned | *gs_pruned;
+    pindex_.apply(g_idx, s_idx, pruned, next_pruned);
 
-    std::pair<size_t, int> solution(s_idx, player(next_pruned, depth + 1).second + 1);
-    //std::cout << "Considering " << wordlist_[solution.first] << ": " << solution.second << std::endl;
+    // Only need to know if this solution is worse than the worst so far
+    const int floor = std::max(alpha, worst_solution.second);
+    std::pair<size_t, int> solution(s_idx,
+        player(next_pruned, depth + 1, floor - 1, beta - 1).second + 1);
 
     worst_solution = std::max(worst_solution, solution, cmp);
+
+    if (worst_solution.second >= beta) {
+      // Already no better than the player's best guess
+      break;
+    }
   }
 
   return worst_solution;
 }
 
+std::pair<size_t, int> WordleSolver::root(const boost::dynamic_bitset<>& pruned,
+                                          int alpha, int beta) {
+  const size_t survivors = size_ - pruned.count();
+  const int lower_bound = min_guesses(survivors);
+  if (survivors <= 1 || lower_bound >= beta) {
+    return player(pruned, 0, alpha, beta);
+  }
+
+  std::vector<size_t> order;
+  PartitionSet tried(pindex_, pruned, DOMINANCE_MAX_SURVIVORS);
+  for (size_t g_idx : order_guesses(pruned)) {
+    if (tried.insert(g_idx)) {
+      order.push_back(g_idx);
+    }
+  }
+
+  // Best value in the high half and its rank in order in the low, so the
+  // minimum is the best guess. Values <= alpha are only known to be good
+  // enough, so they all count as alpha.
+  auto pack = [](size_t rank, int value) {
+    return (uint64_t) value << 32 | rank;
+  };
+  assert(order.size() < UINT32_MAX);
+  // Ranked after every guess, so each has to beat beta
+  std::atomic<uint64_t> best(pack(UINT32_MAX, beta - 1));
+
+  parallel_for(order.size(), [&](size_t rank) {
+    uint64_t current = best.load();
+    const int best_value = (int) (current >> 32);
+    // An earlier guess only has to tie the best so far
+    const int bound = rank < (current & UINT32_MAX) ? best_value + 1 : best_value;
+    if (bound <= std::max(alpha, lower_bound)) {
+      return;
+    }
+
+    const int value = std::max(alpha, antagonist(pruned, order[rank], 0, alpha, bound).second);
+    if (value >= bound) {
+      return;
+    }
+
+    const uint64_t packed = pack(rank, value);
+    while (packed < current && !best.compare_exchange_weak(current, packed)) {}
+  });
+
+  // Every guess is at least beta if none beat it. No useful guess is
+  // reported as player() does.
+  const uint64_t result = best.load();
+  std::pair<size_t, int> best_guess(0, beta);
+  if ((result & UINT32_MAX) != UINT32_MAX) {
+    best_guess = std::pair<size_t, int>(order[result & UINT32_MAX], (int) (result >> 32));
+  }
+
+  MemoFlag flag = MEMO_EXACT;
+  if (best_guess.second <= alpha) {
+    flag = MEMO_UPPER;
+  } else if (best_guess.second >= beta) {
+    flag = MEMO_LOWER;
+  }
+  tt_.store(tt_key(pruned), best_guess.first, best_guess.second, flag, 0);
+  return best_guess;
+}
+
+std::vector<size_t> WordleSolver::order_guesses(const boost::dynamic_bitset<>& pruned) const {
+  std::vector<size_t> survivors;
+  for (size_t s_idx = 0; s_idx < size_; ++s_idx) {
+    if (!pruned[s_idx]) {
+      survivors.push_back(s_idx);
+    }
+  }
+
+  struct Score {
+    size_t largest;
+    size_t buckets;
+    size_t g_idx;
+  };
+  std::vector<Score> scores;
+  std::vector<size_t> order;
+
+  uint32_t counts[NUM_PATTERNS];
+  for (size_t g_idx = 0; g_idx < pindex_.guesses(); ++g_idx) {
+    const size_t g_answer = pindex_.answer_of(g_idx);
+    const bool live_answer = g_answer != PruneIndex::NO_ANSWER && !pruned[g_answer];
+    if (pindex_.square() && !live_answer) {
+      continue;
+    }
+
+    if (survivors.size() < ORDER_MIN_SURVIVORS) {
+      // Not worth scoring: just check the guess splits the answers
+      bool useful = live_answer;
+      for (size_t k = 1; k < survivors.size() && !useful; ++k) {
+        useful = pindex_.code(g_idx, survivors[k]) != pindex_.code(g_idx, survivors[0]);
+      }
+      if (useful) {
+        order.push_back(g_idx);
+      }
+      continue;
+    }
+
+    std::fill(counts, counts + NUM_PATTERNS, 0);
+    Score score = {0, 0, g_idx};
+    for (size_t s_idx : survivors) {
+      const uint32_t count = ++counts[pindex_.code(g_idx, s_idx)];
+      score.buckets += count == 1;
+      score.largest = std::max(score.largest, (size_t) count);
+    }
+
+    if (score.buckets > 1 || live_answer) {
+      scores.push_back(score);
+    }
+  }
+
+  std::sort(scores.begin(), scores.end(), [](const Score& a, const Score& b) {
+    if (a.largest != b.largest) {
+      return a.largest < b.largest;
+    }
+    if (a.buckets != b.buckets) {
+      return a.buckets > b.buckets;
+    }
+    return a.g_idx < b.g_idx;
+  });
+
+  for (const Score& score : scores) {
+    order.push_back(score.g_idx);
+  }
+  return order;
+}
+
 std::pair<size_t, boost::dynamic_bitset<>> WordleSolver::make_guess(boost::dynamic_bitset<> pruned, size_t g_idx) {
   std::pair<size_t, int> worst_solution = antagonist(pruned, g_idx, 0);
   std::cout << "Best possible: " << worst_solution.second << std::endl;
-  return std::pair<size_t, boost::dynamic_bitset<>>(worst_solution.first,
-      pruned | *pindex_.prune(g_idx, worst_solution.first));
+  boost::dynamic_bitset<> next_pruned;
+  pindex_.apply(g_idx, worst_solution.first, pruned, next_pruned);
+  return std::pair<size_t, boost::dynamic_bitset<>>(worst_solution.first, next_pruned);
 }
 
 #endif
@@ -0,0 +1,360 @@
+#include "decision_tree.hpp"
+#include "dictionary.hpp"
+#include "feedback_kernel.hpp"
+#include "feedback_table.hpp"
+#include "pindex_file.hpp"
+#include "prune_index.hpp"
+#include "prune_kernel.hpp"
+#include "simd.hpp"
+#include "word.hpp"
+#include "wordle_solver.hpp"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+ * Cross-checks for `make check`: every backend, kernel and index format
+ * against the others, and the solver and decision trees against known
+ * values, on a square and a rectangular word list.
+ *
+ * USAGE: ./check small_list rect_guesses rect_answers scratch_dir
+ */
+
+size_t failures = 0;
+
+void expect(bool ok, const std::string& what) {
+  if (!ok) {
+    std::cerr << "FAIL: " << what << std::endl;
+    ++failures;
+  }
+}
+
+std::vector<std::string> load_wordlist(const std::string& filename) {
+  std::ifstream file(filename);
+  std::vector<std::string> wordlist;
+  std::string word;
+  while (file >> word) {
+    wordlist.push_back(word);
+  }
+  return wordlist;
+}
+
+std::string read_file(const std::string& filename) {
+  std::ifstream file(filename, std::ios::binary);
+  std::stringstream contents;
+  contents << file.rdbuf();
+  return contents.str();
+}
+
+/**
+ * A few pruned states to apply from: none pruned, every third answer pruned,
+ * and random ones.
+ */
+std::vector<boost::dynamic_bitset<>> sample_states(size_t n) {
+  std::vector<boost::dynamic_bitset<>> states(4, boost::dynamic_bitset<>(n));
+  for (size_t j = 0; j < n; j += 3) {
+    states[1].set(j);
+  }
+
+  std::mt19937_64 rng(n);
+  for (size_t s = 2; s < states.size(); ++s) {
+    for (size_t j = 0; j < n; ++j) {
+      states[s][j] = rng() % 4 != 0;
+    }
+  }
+  return states;
+}
+
+/**
+ * Number of (guess, answer, state) applies on which b differs from a.
+ */
+size_t apply_mismatches(const PruneIndex& a, const PruneIndex& b) {
+  size_t bad = 0;
+  boost::dynamic_bitset<> next_a;
+  boost::dynamic_bitset<> next_b;
+  for (const boost::dynamic_bitset<>& pruned : sample_states(a.size())) {
+    for (size_t i = 0; i < a.guesses(); ++i) {
+      for (size_t j = 0; j < a.size(); ++j) {
+        a.apply(i, j, pruned, next_a);
+        b.apply(i, j, pruned, next_b);
+        bad += next_a != next_b;
+      }
+    }
+  }
+  return bad;
+}
+
+/**
+ * Every backend, in memory and mapped, gives the same apply as the gid map.
+ */
+void check_backends(const std::string& name,
+                    const std::vector<std::string>& guesses,
+                    const std::vector<std::string>& answers,
+                    const std::string& scratch) {
+  const PruneIndex map(guesses, answers, BACKEND_MAP);
+
+  const PruneIndex csr(guesses, answers, BACKEND_CSR);
+  expect(apply_mismatches(map, csr) == 0, name + ": CSR apply differs from MAP");
+
+  // Room for a handful of rows, so they get evicted and rebuilt
+  const size_t row_bytes = (answers.size() + NUM_PATTERNS + 1) * sizeof(uint16_t);
+  const PruneIndex lazy(guesses, answers, BACKEND_LAZY, 4 * row_bytes);
+  expect(apply_mismatches(map, lazy) == 0, name + ": LAZY apply differs from MAP");
+
+  const PruneIndex compressed(guesses, answers, BACKEND_COMPRESSED);
+  expect(apply_mismatches(map, compressed) == 0,
+         name + ": in-memory COMPRESSED apply differs from MAP");
+
+  const std::string bitsets_file = scratch + "/" + name + ".pindex";
+  const std::string compressed_file = scratch + "/" + name + ".compressed.pindex";
+  remove(bitsets_file.c_str());
+  remove(compressed_file.c_str());
+
+  const PruneIndex mapped(guesses, answers, bitsets_file, BACKEND_MAP);
+  expect(mapped.backend() == BACKEND_MAPPED, name + ": index file wasn't mapped");
+  expect(apply_mismatches(map, mapped) == 0, name + ": MAPPED apply differs from MAP");
+
+  const PruneIndex mapped_compressed(guesses, answers, compressed_file, BACKEND_COMPRESSED);
+  expect(apply_mismatches(map, mapped_compressed) == 0,
+         name + ": mapped COMPRESSED apply differs from MAP");
+
+  // Both files again, now read back rather than generated
+  const PruneIndex reopened(guesses, answers, bitsets_file, BACKEND_MAP);
+  expect(apply_mismatches(map, reopened) == 0,
+         name + ": reopened MAPPED apply differs from MAP");
+}
+
+/**
+ * The vector kernels the CPU supports agree with the scalar ones.
+ */
+void check_kernels(const std::string& name,
+                   const std::vector<std::string>& guesses,
+                   const std::vector<std::string>& answers) {
+  const GuessPairIndex pairs(guesses, answers, false);
+
+  std::vector<uint8_t> letters[5];
+  for (size_t pos = 0; pos < 5; ++pos) {
+    for (const std::string& answer : answers) {
+      letters[pos].push_back((uint8_t) (answer[pos] - 'a'));
+    }
+  }
+  const uint8_t* columns[5];
+  for (size_t pos = 0; pos < 5; ++pos) {
+    columns[pos] = letters[pos].data();
+  }
+
+  std::vector<uint8_t> scalar(answers.size());
+  std::vector<uint8_t> vector(answers.size());
+  for (size_t i = 0; i < guesses.size(); ++i) {
+    const uint8_t* guess = pairs.guess_letters(i);
+    feedback_codes_scalar(guess, columns, 0, answers.size(), scalar.data());
+    for (size_t j = 0; j < answers.size(); ++j) {
+      expect(scalar[j] == feedback_code(guess, Word(answers[j]).get_letters()),
+             name + ": scalar feedback kernel differs from feedback_code");
+    }
+#ifdef SIMD_X86
+    if (simd_level() >= SIMD_AVX2) {
+      feedback_codes_avx2(guess, columns, answers.size(), vector.data());
+      expect(scalar == vector, name + ": AVX2 feedback kernel differs from scalar");
+    }
+#endif
+  }
+
+  // Real masks over random words and counts, with an odd length for the tails
+  const FeedbackTable table(guesses);
+  std::mt19937_64 rng(guesses.size());
+  const size_t n = 1000 + 13;
+  std::vector<uint32_t> words(n);
+  std::vector<uint64_t> counts(n);
+  for (size_t k = 0; k < n; ++k) {
+    words[k] = (uint32_t) rng() & 0x1FFFFFF;
+    counts[k] = rng() & rng();
+  }
+  std::vector<uint64_t> start((n + 63) / 64);
+  for (uint64_t& block : start) {
+    block = rng() & rng();
+  }
+
+  for (size_t i = 0; i < guesses.size(); ++i) {
+    for (size_t code = 0; code < NUM_PATTERNS; code += 7) {
+      const PruneMask& m = table.mask(i, (uint8_t) code);
+      std::vector<uint64_t> expected = start;
+      prune_words_scalar(m, words.data(), counts.data(), 0, n, expected.data());
+#ifdef SIMD_X86
+      if (simd_level() >= SIMD_AVX2) {
+        std::vector<uint64_t> pruned = start;
+        prune_words_avx2(m, words.data(), counts.data(), n, pruned.data());
+        expect(pruned == expected, name + ": AVX2 prune kernel differs from scalar");
+      }
+      if (simd_level() >= SIMD_AVX512) {
+        std::vector<uint64_t> pruned = start;
+        prune_words_avx512(m, words.data(), counts.data(), n, pruned.data());
+        expect(pruned == expected, name + ": AVX-512 prune kernel differs from scalar");
+      }
+#endif
+    }
+  }
+}
+
+/**
+ * Dictionary prunes in every mode agree with the prune index, on a square
+ * list where both prune the same words.
+ */
+void check_dictionary(const std::string& name, const std::vector<std::string>& wordlist) {
+  const FeedbackTable table(wordlist);
+  const PruneIndex pindex(wordlist, BACKEND_MAP);
+  const boost::dynamic_bitset<> none(wordlist.size());
+  boost::dynamic_bitset<> expected;
+
+  for (PruneMode mode : {PRUNE_SCAN, PRUNE_COMPACT, PRUNE_INDEX}) {
+    Dictionary dictionary(wordlist, mode);
+    for (size_t i = 0; i < wordlist.size(); ++i) {
+      for (size_t j = 0; j < wordlist.size(); ++j) {
+        pindex.apply(i, j, none, expected);
+        dictionary.prune(table.mask(i, table.code(i, j)));
+        expect(dictionary.key() == expected,
+               name + ": Dictionary prune differs from the prune index");
+        dictionary.pop();
+      }
+    }
+  }
+}
+
+/**
+ * Updating an index built from shorter lists gives the same file as
+ * generating it from scratch, in both formats.
+ */
+void check_update(const std::string& name,
+                  const std::vector<std::string>& guesses,
+                  const std::vector<std::string>& answers,
+                  const std::string& scratch) {
+  // Old lists: some answers left out, and for rectangular lists the last
+  // tenth of the guesses too
+  std::vector<std::string> old_answers;
+  for (size_t j = 0; j < answers.size(); ++j) {
+    if (j % 12 != 3) {
+      old_answers.push_back(answers[j]);
+    }
+  }
+  const std::vector<std::string> old_guesses = guesses == answers ? old_answers :
+    std::vector<std::string>(guesses.begin(), guesses.end() - (long) guesses.size() / 10);
+
+  for (IndexBackend backend : {BACKEND_MAP, BACKEND_COMPRESSED}) {
+    const std::string suffix = backend == BACKEND_COMPRESSED ? ".compressed" : "";
+    const std::string old_file = scratch + "/" + name + ".old" + suffix + ".pindex";
+    const std::string updated_file = scratch + "/" + name + ".updated" + suffix + ".pindex";
+    const std::string fresh_file = scratch + "/" + name + ".fresh" + suffix + ".pindex";
+    remove(old_file.c_str());
+    remove(fresh_file.c_str());
+
+    { const PruneIndex old(old_guesses, old_answers, old_file, backend); }
+    expect(PruneIndex::update(old_guesses, old_answers, old_file,
+                              guesses, answers, updated_file),
+           name + ": update" + suffix + " failed");
+    { const PruneIndex fresh(guesses, answers, fresh_file, backend); }
+
+    expect(read_file(updated_file) == read_file(fresh_file),
+           name + ": updated" + suffix + " index differs from a fresh one");
+
+    const PruneIndex map(guesses, answers, BACKEND_MAP);
+    const PruneIndex updated(guesses, answers, updated_file, backend);
+    expect(apply_mismatches(map, updated) == 0,
+           name + ": updated" + suffix + " index apply differs from MAP");
+  }
+}
+
+/**
+ * Both searches find the known optimal value, and every answer played
+ * through the saved decision tree is found within it.
+ */
+void check_solve(const std::string& name,
+                 const std::vector<std::string>& guesses,
+                 const std::vector<std::string>& answers,
+                 int value, const std::string& scratch) {
+  WordleSolver solver(PruneIndex(guesses, answers), (size_t) 16 << 20);
+  const std::pair<size_t, int> best = solver.solve();
+  expect(best.second == value, name + ": solve() value " + std::to_string(best.second) +
+                               ", expected " + std::to_string(value));
+  expect(solver.solve_by_deepening().second == value,
+         name + ": solve_by_deepening() disagrees with solve()");
+
+  const uint64_t fingerprint = wordlist_fingerprint(guesses, answers);
+  const std::string tree_file = scratch + "/" + name + ".dtree";
+  {
+    std::ofstream os(tree_file, std::ios::binary);
+    expect(DecisionTree::build(solver, os, fingerprint), name + ": tree build failed");
+  }
+
+  DecisionTree tree;
+  if (!tree.open(tree_file, fingerprint)) {
+    expect(false, name + ": can't open the saved tree");
+    return;
+  }
+  DecisionTree other;
+  expect(!other.open(tree_file, fingerprint + 1), name + ": tree opened for other lists");
+
+  const PruneIndex& pindex = solver.pindex();
+  for (size_t s_idx = 0; s_idx < answers.size(); ++s_idx) {
+    std::vector<std::pair<size_t, uint8_t>> history;
+    for (int turn = 1; ; ++turn) {
+      const std::pair<size_t, int> next = tree.next_guess(history);
+      if (next.first == DecisionTree::NO_GUESS || turn > value ||
+          (turn == 1 && next.second != value)) {
+        expect(false, name + ": tree doesn't find " + answers[s_idx] +
+                      " within " + std::to_string(value));
+        break;
+      }
+      const uint8_t code = pindex.code(next.first, s_idx);
+      if (code == ALL_GREEN) {
+        break;
+      }
+      history.emplace_back(next.first, code);
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  if (argc != 5) {
+    std::cerr << "USAGE: ./check small_list rect_guesses rect_answers scratch_dir"
+              << std::endl;
+    return 1;
+  }
+
+  const std::vector<std::string> small = load_wordlist(argv[1]);
+  const std::vector<std::string> rect_guesses = load_wordlist(argv[2]);
+  const std::vector<std::string> rect_answers = load_wordlist(argv[3]);
+  const std::string scratch = argv[4];
+
+  check_backends("small", small, small, scratch);
+  check_backends("rect", rect_guesses, rect_answers, scratch);
+
+  check_kernels("small", small, small);
+  check_kernels("rect", rect_guesses, rect_answers);
+  check_dictionary("small", small);
+
+  check_update("small", small, small, scratch);
+  check_update("rect", rect_guesses, rect_answers, scratch);
+
+  // Known optimal values: 4 guesses for config/small.txt, and 3 for the
+  // rectangular answers guessed from config/solution_words.txt
+  check_solve("small", small, small, 4, scratch);
+  check_solve("rect", rect_guesses, rect_answers, 3, scratch);
+
+  if (failures) {
+    std::cerr << failures << " checks failed" << std::endl;
+    return 1;
+  }
+  std::cout << "All checks passed"
+            << (simd_level() == SIMD_AVX512 ? " (scalar, AVX2 and AVX-512 kernels)" :
+                simd_level() == SIMD_AVX2 ? " (scalar and AVX2 kernels)" :
+                " (scalar kernels only)")
+            << std::endl;
+  return 0;
+}